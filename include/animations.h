@@ -5,11 +5,25 @@
 #include "led_control.h"
 #include "constants.h"
 
-void showConnectingAnimation();
-void showWiFiConnectedAnimation();
-void showWebSocketConnectedAnimation();
+#define CHILD_LOCK_BLINK_MS 200
+
+// Connection and child lock animations are overlays: the loop task draws them a frame at a time
+// over the whole strip while keys stay usable underneath, and each key is redrawn when they end
+enum OverlayAnimation : uint8_t {
+    OVERLAY_NONE,
+    OVERLAY_CONNECTING,           // Blue, repeats until replaced
+    OVERLAY_WIFI_CONNECTED,       // Green blinks
+    OVERLAY_WEBSOCKET_CONNECTED,  // Cyan and yellow blinks
+    OVERLAY_CHILD_LOCK_ENABLED,   // Purple blinks
+    OVERLAY_CHILD_LOCK_DISABLED   // White blinks
+};
+
+void startOverlayAnimation(OverlayAnimation animation);
+void cancelOverlayAnimation();
+bool overlayActive();
+unsigned long overlayNextDue(); // Milliseconds until the next frame, ULONG_MAX without an overlay
+void renderOverlayFrame();
+
 void showConnectionFailedAnimation();
 void showWebSocketConnectionFailedAnimation();
-void showChildLockEnabledAnimation();
-void showChildLockDisabledAnimation();
 #endif // ANIMATIONS_H
@@ -0,0 +1,26 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include "common.h"
+
+// Records when each part of boot first completes, in millis() since the app started.
+// WiFi, the WebSocket and key scanning come up concurrently, so a key is usable as soon
+// as it is scanned, Home Assistant has accepted our token and the state snapshot (which
+// group toggles read) has been applied, whichever of those happens last.
+
+enum BootStage : uint8_t {
+    BOOT_KEYS_SCANNING,
+    BOOT_WIFI_UP,
+    BOOT_WEBSOCKET_CONNECTED,
+    BOOT_AUTHENTICATED,
+    BOOT_STATE_RESTORED,
+    BOOT_STAGE_COUNT
+};
+
+extern volatile unsigned long bootStageMillis[BOOT_STAGE_COUNT]; // 0 until the stage is reached
+
+void bootMark(BootStage stage);
+unsigned long bootToFirstUsableKeyMs(); // 0 until every key is usable
+void printBootTimeline();
+
+#endif // BOOT_TIMELINE_H
@@ -10,6 +10,13 @@
 #include <esp_task_wdt.h>
 #include "animations.h"
 #include "websocket_handler.h"
+#include "gesture.h"
+#include "event_loop.h"
+#include "profiler.h"
+#include "boot_timeline.h"
+#include "metrics.h"
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
 
 
 extern unsigned long lastDebounceTime[ROWS][COLS];
@@ -20,14 +27,13 @@ extern bool upButtonPressed;
 extern bool downButtonPressed;
 extern unsigned long lastBrightnessAdjustTime;
 extern bool isBrightnessAdjustmentMode;
-extern int currentAdjustmentBrightness;
-extern unsigned long brightnessAdjustmentStartTime;
-extern int lastAdjustedX;
-extern int lastAdjustedY;
+extern GestureKey gestureKeys[ROWS][COLS];
 
 void buttonCheckTask(void * parameter);
 bool adjustBrightnessOrVolume(int x, int y, bool increase);
 void updateButtonStates();
 void toggleChildLock();
+void switchToNextPage();
+void initializeGestures();
 
 #endif // BUTTON_CONTROL_H
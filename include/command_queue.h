@@ -0,0 +1,62 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include "common.h"
+#include "config.h"
+
+// Outbound commands are queued as small descriptors and only turned into JSON by the
+// loop task when they are sent, so message ids go out in order and a press made while
+// the socket is down is kept until the connection is authenticated again.
+//
+// Control messages (auth, subscribe) always go first and are dropped with the connection
+// they belong to. Toggles come next, then level changes; a newer level for an entity
+// replaces one that has not been sent yet. Toggles and levels older than
+// OFFLINE_COMMAND_TTL_MS are discarded instead of being replayed.
+
+#define COMMAND_QUEUE_SIZE 16
+#define COMMAND_BATCH_SIZE 8 // Most levels sent together in one message
+
+enum CommandPriority : uint8_t {
+    COMMAND_PRIORITY_CONTROL,
+    COMMAND_PRIORITY_TOGGLE,
+    COMMAND_PRIORITY_LEVEL
+};
+
+enum CommandKind : uint8_t {
+    COMMAND_AUTH,
+    COMMAND_SUBSCRIBE,
+    COMMAND_TOGGLE,   // value: 1 if a group key was lit when pressed
+    COMMAND_GESTURE,  // action: the gesture's action
+    COMMAND_LEVEL     // value: brightness, or volume * 255 for media players
+};
+
+enum CommandLinkState : uint8_t {
+    COMMAND_LINK_DOWN,
+    COMMAND_LINK_CONNECTED,     // Only control messages may be sent
+    COMMAND_LINK_AUTHENTICATED
+};
+
+struct OutboundCommand {
+    CommandKind kind;
+    int8_t mapping;           // Index into entityMappings, -1 for control messages
+    GestureAction action;
+    int value;
+    uint32_t sequence;        // Assigned when queued; oldest goes first within a priority
+    unsigned long queuedTime;
+};
+
+typedef bool (*CommandSender)(const OutboundCommand& command); // false keeps the command queued for a retry
+typedef bool (*CommandBatchSender)(const OutboundCommand* commands, int count); // Levels only, oldest first
+
+extern volatile unsigned long commandsDropped;
+extern volatile unsigned long commandsExpired;
+extern volatile unsigned long commandsSuperseded;
+
+bool queueCommand(CommandKind kind, int mapping = -1, int value = 0, GestureAction action = GESTURE_ACTION_NONE);
+int queueLevels(const int* mappings, const int* values, int count);
+int requeueLevels(const int* mappings, const int* values, int count);
+void setCommandLinkState(CommandLinkState state);
+void serviceCommandQueue(CommandSender send, CommandBatchSender sendLevels = nullptr);
+int queuedCommandCount();
+
+#endif // COMMAND_QUEUE_H
@@ -2,22 +2,30 @@
 #define COMMON_H
 
 #include <Arduino.h>
+#include "config_defaults.h"
 
 #define ENABLE_SERIAL_LOGGING false
+#define ENABLE_LOG_RING true // Cheap binary log of hot-path events; drained over serial when idle
+#define ENABLE_PROFILER false // Samples tasks/heap/queue; send 'p' over serial for a report
+#define ENABLE_METRICS_ENDPOINT false // Serves Prometheus metrics on port 9100 at /metrics
+#define USE_RMT_LED_DRIVER true // Non-blocking RMT output; false falls back to Adafruit_NeoPixel
 
 #define SERIAL_PRINT(x) if (ENABLE_SERIAL_LOGGING) Serial.print(x)
 #define SERIAL_PRINTLN(x) if (ENABLE_SERIAL_LOGGING) Serial.println(x)
 #define SERIAL_PRINTF(format, ...) if (ENABLE_SERIAL_LOGGING) Serial.printf(format, __VA_ARGS__)
 
 #define MAX_QUEUED_MESSAGES 50
+#define QUEUE_ARENA_SIZE 16384 // Bytes reserved at startup for messages queued during brightness adjustment
 #define BRIGHTNESS_UPDATE_TIMEOUT_MS 20000
 
 extern unsigned long messageId;
-extern SemaphoreHandle_t xMutex;
+extern SemaphoreHandle_t xMutex; // Guards the strip, fades and overlay; entity states are read without it
 extern SemaphoreHandle_t queueMutex;
+extern SemaphoreHandle_t commandQueueMutex;
+extern TaskHandle_t loopTaskHandle;
+extern TaskHandle_t buttonTaskHandle;
 extern volatile int queuedMessageCount;
 extern volatile bool isBrightnessUpdateInProgress;
-extern bool isNightMode;
-extern int currentHour;
+extern volatile uint8_t brightnessScale; // Current night mode scale, 255 = full brightness
 
 #endif // COMMON_H
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef COMPACT_STATE_H
+#define COMPACT_STATE_H
+
+#include "common.h"
+#include "config.h"
+#include "entity_state.h"
+#include "led_control.h"
+
+// With USE_TEMPLATE_SUBSCRIPTION, Home Assistant renders a single template whose
+// result packs every mapped entity into a fixed layout, in entityMappings order
+// (members of multi-entity mappings in the order they are listed):
+//
+//   s,r,g,b,brightness,volume;s,r,g,b,brightness,volume;...
+//
+// s is 1 for on/playing, volume is scaled to 0-255, -1 marks a missing
+// attribute and an empty record a missing entity.
+
+size_t buildStateTemplateMessage(char* buffer, size_t size, unsigned long id);
+void beginCompactState();
+void feedCompactState(const char* data, size_t length);
+
+#endif // COMPACT_STATE_H
@@ -0,0 +1,88 @@
+#ifndef CONFIG_DEFAULTS_H
+#define CONFIG_DEFAULTS_H
+
+// Defaults for settings added to config.h and secrets.h after they were first written, so a
+// config.h or secrets.h copied from an older example keeps building. Each default matches the
+// example file, except where noted. See "Updating an older config.h" in the README.
+// Like gesture.h and fade.h, this doesn't include Arduino.h.
+
+#include <stdint.h>
+#include <string.h> // config.h needs strncmp
+#include "config.h"
+#include "secrets.h"
+
+#ifndef NUM_PAGES
+#define NUM_PAGES 1 // A single page, so the page buttons stay ordinary keys
+#endif
+#ifndef PAGE_BUTTON1_X
+#define PAGE_BUTTON1_X 0
+#define PAGE_BUTTON1_Y 3
+#define PAGE_BUTTON2_X 5
+#define PAGE_BUTTON2_Y 3
+#endif
+
+#ifndef DOUBLE_TAP_WINDOW
+#define DOUBLE_TAP_WINDOW 300
+#endif
+#ifndef NIGHT_RAMP_MINUTES
+#define NIGHT_RAMP_MINUTES 30
+#endif
+
+#ifndef LED_FADE_MS
+#define LED_FADE_MS 250
+#endif
+#ifndef LED_FADE_EASING
+#define LED_FADE_EASING FADE_EASE_IN_OUT
+#endif
+
+// Night mode hours are then in UTC; initializeNightMode() says so on the serial log
+#ifndef TIMEZONE
+#define TIMEZONE "UTC0"
+#define TIMEZONE_NOT_CONFIGURED
+#endif
+#ifndef NTP_SERVER
+#define NTP_SERVER "pool.ntp.org"
+#endif
+
+#ifndef ENABLE_LIGHT_SLEEP
+#define ENABLE_LIGHT_SLEEP false
+#endif
+
+#ifndef HEARTBEAT_INTERVAL_MS
+#define HEARTBEAT_INTERVAL_MS 5000
+#endif
+#ifndef HEARTBEAT_MAX_MISSED
+#define HEARTBEAT_MAX_MISSED 2
+#endif
+#ifndef HEALTH_LED_X
+#define HEALTH_LED_X -1
+#define HEALTH_LED_Y -1
+#endif
+
+#ifndef OFFLINE_COMMAND_TTL_MS
+#define OFFLINE_COMMAND_TTL_MS 10000
+#endif
+#ifndef BATCH_LEVEL_UPDATES
+#define BATCH_LEVEL_UPDATES true
+#endif
+#ifndef USE_TEMPLATE_SUBSCRIPTION
+#define USE_TEMPLATE_SUBSCRIPTION false
+#endif
+#ifndef SUBSCRIBE_MESSAGE_BUFFER_SIZE
+#define SUBSCRIBE_MESSAGE_BUFFER_SIZE 2048
+#endif
+
+#ifndef HA_STANDBY_ENDPOINTS
+#define HA_STANDBY_ENDPOINTS
+#endif
+#ifndef HA_USE_TLS
+#define HA_USE_TLS false
+#endif
+#ifndef HA_CA_CERT
+#define HA_CA_CERT ""
+#endif
+#ifndef HA_CERT_FINGERPRINT
+#define HA_CERT_FINGERPRINT ""
+#endif
+
+#endif // CONFIG_DEFAULTS_H
@@ -5,21 +5,52 @@
 #include "config.h"
 #include "constants.h"
 #include "led_control.h"
+#include <atomic>
 
-struct EntityState {       
+#define MAX_GROUP_MEMBERS 32
+#define MAX_ENTITY_ID_LENGTH 64
+
+// Kept small because every page's keys are cached; the key's position is its index in entityStates
+struct EntityState {
     bool is_on;
     uint8_t r, g, b;
     uint8_t brightness;
-    int x, y;
-    bool is_playing;
     float volume;
+    uint32_t members_on; // One bit per group member, is_on is true if any member is on
 };
 
-extern EntityState entityStates[ROWS][COLS];
-extern EntityState savedStates[ROWS][COLS];
+// Parsed subset of an entity's state, independent of the message format it arrived in
+struct EntityUpdate {
+    bool has_state;
+    bool is_on;
+    bool has_attributes;
+    bool has_rgb;
+    uint8_t r, g, b;
+    bool has_brightness;
+    uint8_t brightness;
+    bool has_volume;
+    float volume;
+    uint8_t member; // Index of the entity within a multi-entity mapping
+};
+
+extern int8_t pageMappings[NUM_PAGES][ROWS][COLS]; // Mapping index of each key, -1 if none; built at startup
+extern volatile uint8_t currentPage;               // Written under xMutex
+
+// Every page's key states have a single writer, the loop task applying Home Assistant updates.
+// Each key is published through its own sequence counter, so readers on any task get a
+// consistent copy without taking a lock, and the writer never waits for a reader.
+EntityState readEntityState(int page, int x, int y);
+void writeEntityState(int page, int x, int y, const EntityState& state);
+
+// State of a key on the page currently shown
+inline EntityState readKeyState(int x, int y) {
+    return readEntityState(currentPage, x, y);
+}
 
 void initializeEntityStates();
-void saveCurrentStates();
-void restoreStates();
+int findMappingIndex(int x, int y);
+int mappingMemberCount(int mappingIndex);
+int findMappingMember(int mappingIndex, const char* entity_id);
+bool getMappingMember(int mappingIndex, int member, char* buffer, size_t size);
 
 #endif // ENTITY_STATE_H
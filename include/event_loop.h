@@ -0,0 +1,17 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "common.h"
+#include "config.h"
+#include "websocket_handler.h"
+#include "profiler.h"
+
+#define LOOP_MAX_WAIT_MS 1000       // Longest the loop task blocks with nothing scheduled
+#define LOOP_UNWATCHED_SOCKET_POLL_MS 20 // Wait while connected through a client whose socket can't be selected on
+#define SERIAL_POLL_INTERVAL_MS 250 // Serial input can't wake the loop, so it is polled while serial commands are enabled
+
+void initializeEventLoop();
+void notifyLoopTask();
+void waitForLoopEvent(unsigned long timeoutMs);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,29 @@
+#ifndef FADE_H
+#define FADE_H
+
+#include <stdint.h>
+#include "constants.h"
+#include "config_defaults.h" // Not common.h: this module avoids Arduino.h so it builds on a host
+
+enum FadeEasing : uint8_t {
+    FADE_LINEAR,
+    FADE_EASE_IN_OUT
+};
+
+// Per-pixel colour transition. Channels are 8.8 fixed point so slow fades don't stall on rounding.
+struct FadePixel {
+    uint16_t from[3];
+    uint16_t to[3];
+    uint32_t startTime;
+    uint16_t duration;
+    bool active;
+};
+
+typedef void (*FadeWriter)(int index, uint32_t color);
+
+void fadeSetTarget(int index, uint32_t shownColor, uint32_t targetColor, uint32_t now);
+void fadeCancelAll();
+bool fadeActive();
+bool fadeTick(uint32_t now, FadeWriter write);
+
+#endif // FADE_H
@@ -0,0 +1,37 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <stdint.h>
+#include "config_defaults.h" // Not common.h: this module avoids Arduino.h so it builds on a host
+
+// Events reported by gestureUpdate, as a bitmask since a single scan can complete two
+// (e.g. a hold threshold crossed and the key released in the same scan)
+#define GESTURE_TAP        0x01 // Released before LONG_PRESS_TIME; reported on release, never delayed
+#define GESTURE_DOUBLE_TAP 0x02 // Pressed again within DOUBLE_TAP_WINDOW of a tap; reported on the second press
+#define GESTURE_HOLD       0x04 // Still held at LONG_PRESS_TIME; reported while the key is down
+#define GESTURE_LONG_PRESS 0x08 // Released after LONG_PRESS_TIME
+
+enum GestureState : uint8_t {
+    GESTURE_STATE_IDLE,
+    GESTURE_STATE_PRESSED,
+    GESTURE_STATE_HELD,
+    GESTURE_STATE_WAITING,        // Tapped once, a second press now counts as a double tap
+    GESTURE_STATE_SECOND_PRESSED,
+    GESTURE_STATE_SUPPRESSED,     // Cancelled; swallow everything until released
+    GESTURE_STATE_COUNT
+};
+
+struct GestureKey {
+    GestureState state;
+    bool wasPressed;
+    bool multiTap;                // Key has a double tap binding, otherwise taps never wait
+    unsigned long pressTime;
+    unsigned long releaseTime;
+};
+
+void gestureInit(GestureKey& key, bool multiTap);
+uint8_t gestureUpdate(GestureKey& key, bool pressed, unsigned long now);
+void gestureCancel(GestureKey& key);
+bool gestureIdle(const GestureKey& key);
+
+#endif // GESTURE_H
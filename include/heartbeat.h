@@ -0,0 +1,21 @@
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include "common.h"
+#include "config.h"
+
+// Pings Home Assistant over the API and matches pongs by message id. A half-open
+// connection (e.g. after an AP roam) never answers, so after HEARTBEAT_MAX_MISSED
+// unanswered pings the socket is dropped and reconnected instead of waiting on TCP.
+
+extern unsigned long heartbeatRttMicros;    // Smoothed round trip time
+extern unsigned long heartbeatJitterMicros; // Smoothed deviation from it
+extern unsigned long heartbeatReconnects;
+
+void heartbeatStart();
+void heartbeatStop();
+void heartbeatPong(unsigned long id);
+void heartbeatTick();
+unsigned long heartbeatNextDue();
+
+#endif // HEARTBEAT_H
@@ -10,11 +10,26 @@
 #include "animations.h"
 #include <ArduinoJson.h>
 #include "common.h"
+#include "compact_state.h"
+#include "state_stream.h"
+#include "heartbeat.h"
+#include "profiler.h"
+#include "boot_timeline.h"
+#include "command_queue.h"
+
+#define SERVICE_CALL_DOC_SIZE 1024
+#define SERVICE_CALL_MESSAGE_SIZE 1024
 
 void handleHomeAssistantMessage(uint8_t* payload, size_t length);
-void updateTimeAndCheckNightMode(const char* time_str);
+void beginHomeAssistantMessage();
+void feedHomeAssistantMessage(const uint8_t* data, size_t length);
+void finishHomeAssistantMessage();
 void toggleEntity(int x, int y);
+void performGestureAction(int x, int y, GestureAction action);
 void subscribeToEntities();
-void sendBrightnessOrVolumeUpdate(const char* entity_id, int value, bool is_media_player);
+size_t buildSubscribeEntitiesMessage(char* buffer, size_t size, unsigned long id);
+void sendBrightnessOrVolumeUpdate(int mapping, int value);
+void sendBrightnessOrVolumeUpdates(const int* mappings, const int* values, int count);
+void sendQueuedCommands();
 
 #endif // HOMEASSISTANT_HANDLER_H
@@ -0,0 +1,52 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h> // This module avoids Arduino.h so it builds on a host
+
+// Incremental JSON tokenizer. Input can be fed in chunks of any size, split anywhere
+// (including inside strings and escapes), and tokens are reported as soon as they end,
+// so memory use is fixed no matter how large the document is.
+//
+// depth is the number of containers enclosing the token: the outermost '{' and '}' are
+// at depth 0 and its keys and values at depth 1.
+
+#define JSON_STREAM_MAX_DEPTH 32
+#define JSON_STREAM_TOKEN_SIZE 64 // Longest key, number or literal; longer string values arrive in parts
+
+enum JsonStreamToken : uint8_t {
+    JSON_OBJECT_START,
+    JSON_OBJECT_END,
+    JSON_ARRAY_START,
+    JSON_ARRAY_END,
+    JSON_KEY,         // Keys longer than JSON_STREAM_TOKEN_SIZE - 1 are reported empty
+    JSON_STRING_PART, // Leading part of a long string value; the rest follows as JSON_STRING
+    JSON_STRING,
+    JSON_NUMBER,      // Unparsed, e.g. "0.45" or "-1e3"
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL
+};
+
+typedef void (*JsonStreamHandler)(JsonStreamToken token, const char* text, size_t length, int depth);
+
+struct JsonStream {
+    JsonStreamHandler handler;
+    uint8_t state;
+    uint8_t depth;
+    uint32_t objectLevels;  // Bit n set when the container at depth n is an object
+    bool expectKey;         // Next string in the current object is a key
+    char separator;         // ':' after a key, ',' after a value, '\0' where a value must come next
+    bool keyOverflow;
+    bool failed;
+    uint8_t unicodeDigits;
+    uint16_t unicodeValue;
+    size_t tokenLength;
+    char token[JSON_STREAM_TOKEN_SIZE];
+};
+
+void jsonStreamInit(JsonStream& stream, JsonStreamHandler handler);
+bool jsonStreamFeed(JsonStream& stream, const char* data, size_t length);
+bool jsonStreamFinish(JsonStream& stream);
+
+#endif // JSON_STREAM_H
@@ -2,17 +2,38 @@
 #define LED_CONTROL_H
 
 #include "common.h"
+#if USE_RMT_LED_DRIVER
+#include "led_strip.h"
+typedef RmtStrip LedStrip;
+#else
 #include <Adafruit_NeoPixel.h>
-#include <ArduinoJson.h>
+typedef Adafruit_NeoPixel LedStrip;
+#endif
 #include "constants.h"
 #include "config.h"
 #include "entity_state.h"
+#include "log_ring.h"
+#include "fade.h"
 
-extern Adafruit_NeoPixel strip;
+#define LED_FRAME_INTERVAL_MS 16 // Fades render at most ~60 frames per second
+
+struct EntityUpdate;
+
+// One key's level while it is being adjusted, drawn in the key's colour
+struct LevelBar {
+    int level; // 0-255
+    uint8_t r, g, b;
+};
+
+extern LedStrip strip;
 
 int getLedIndex(int x, int y);
-void updateLED(int x, int y, const JsonObject& state = JsonObject());
-void displayBrightnessLevel(int brightness, uint8_t r, uint8_t g, uint8_t b);
+void updateLED(int x, int y);
+void updateLEDState(int page, int x, int y, const EntityUpdate* update);
+void showPage(uint8_t page);
+void renderLedFrame();
+void setHealthIndicator(uint32_t color);
+void displayLevelBars(const LevelBar* bars, int count);
 uint32_t applyBrightnessScalar(uint32_t color);
 
 #endif // LED_CONTROL_H
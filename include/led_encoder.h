@@ -0,0 +1,23 @@
+#ifndef LED_ENCODER_H
+#define LED_ENCODER_H
+
+#include <stdint.h>
+#include <stddef.h> // This module avoids Arduino.h so it builds on a host
+
+// Encodes GRB pixels into RMT items for WS2812 LEDs. Each item is a 32 bit word laid out like
+// rmt_item32_t: duration0 (15 bits), level0, duration1 (15 bits), level1.
+//
+// Ticks are 25ns, from the 80MHz APB clock divided by LED_RMT_CLOCK_DIVIDER.
+#define LED_RMT_CLOCK_DIVIDER 2
+#define LED_T0H_TICKS 16     // 0.40us high, then
+#define LED_T0L_TICKS 34     // 0.85us low for a 0 bit
+#define LED_T1H_TICKS 32     // 0.80us high, then
+#define LED_T1L_TICKS 18     // 0.45us low for a 1 bit
+#define LED_RESET_TICKS 12000 // 300us low latches the frame, long enough for newer WS2812B revisions
+
+#define LED_FRAME_ITEMS(count) ((count) * 24 + 1) // 24 bits per pixel plus the reset item
+
+uint32_t ledItem(uint16_t duration0, bool level0, uint16_t duration1, bool level1);
+size_t encodeLedFrame(const uint8_t* grb, uint16_t count, uint32_t* items);
+
+#endif // LED_ENCODER_H
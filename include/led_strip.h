@@ -0,0 +1,46 @@
+#ifndef LED_STRIP_H
+#define LED_STRIP_H
+
+#include "common.h"
+#include "constants.h"
+#include "led_encoder.h"
+#include "metrics.h"
+#include <driver/rmt.h>
+
+#define LED_SHOW_TIMEOUT_MS 10 // A 24 LED frame takes under 1ms; this only guards against a stuck channel
+
+// WS2812 output through the RMT peripheral, with the same calls as Adafruit_NeoPixel.
+// show() encodes the frame into one of two buffers and starts the transfer without
+// waiting for it; it only blocks if the previous frame is still going out.
+class RmtStrip {
+public:
+    RmtStrip(uint16_t count, int pin, rmt_channel_t channel = RMT_CHANNEL_0);
+
+    void begin();
+    void show();
+    bool busy() const;
+
+    void setPixelColor(uint16_t n, uint32_t color);
+    void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b);
+    uint32_t getPixelColor(uint16_t n) const;
+    void clear();
+    uint16_t numPixels() const { return count; }
+
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) {
+        return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+    }
+
+private:
+    static void transmitDone(rmt_channel_t channel, void* arg);
+
+    uint16_t count;
+    int pin;
+    rmt_channel_t channel;
+    bool started;
+    volatile bool transmitting;
+    uint8_t nextBuffer;
+    uint8_t pixels[NUM_LEDS * 3]; // GRB, as sent on the wire
+    uint32_t items[2][LED_FRAME_ITEMS(NUM_LEDS)];
+};
+
+#endif // LED_STRIP_H
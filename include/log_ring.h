@@ -0,0 +1,56 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include "common.h"
+#include <atomic>
+
+#define LOG_RING_SIZE 64 // Must be a power of two
+#define LOG_MAX_ARGS 6
+#define LOG_DRAIN_BATCH 8
+
+enum LogLevel : uint8_t {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+};
+
+// Every message is recorded as its id plus raw integer arguments; the format
+// string is only looked up when the ring is drained.
+#define LOG_MESSAGES(X) \
+    X(LOG_LED_UPDATE, "Updating LED at (%d, %d)") \
+    X(LOG_LED_UPDATED, "Updated LED at (%d, %d): Color=%06X, Brightness=%d, Scaled Brightness=%d, Is On=%d") \
+    X(LOG_ADJUST_ENTER, "Entering adjustBrightnessOrVolume: x=%d, y=%d, increase=%d") \
+    X(LOG_ADJUST_CHILD_LOCK, "Child lock mode active, ignoring brightness/volume adjustment") \
+    X(LOG_ADJUST_SKIP_SWITCH, "Entity at (%d, %d) is a switch, skipping brightness/volume adjustment") \
+    X(LOG_ADJUST_SKIP_UNSUPPORTED, "Entity at (%d, %d) is neither a light nor a media player, skipping adjustment") \
+    X(LOG_ADJUST_MODE_ENTER, "Entering adjustment mode for (%d, %d) at level %d") \
+    X(LOG_ADJUST_VALUE, "Adjusted value for (%d, %d) to %d") \
+    X(LOG_ADJUST_MUTEX_FAILED, "Failed to acquire mutex in adjustBrightnessOrVolume")
+
+#define LOG_MESSAGE_ID(id, format) id,
+enum LogMessageId : uint16_t {
+    LOG_MESSAGES(LOG_MESSAGE_ID)
+    LOG_MESSAGE_COUNT
+};
+#undef LOG_MESSAGE_ID
+
+struct LogRecord {
+    std::atomic<uint32_t> sequence; // slot index + 1 once the record is complete
+    uint32_t timestamp;             // micros()
+    uint16_t id;
+    uint8_t level;
+    int32_t args[LOG_MAX_ARGS];
+};
+
+extern volatile uint8_t logLevelThreshold;
+extern volatile unsigned long logOverrunCount;
+
+#define LOG_EVENT(level, ...) \
+    do { if (ENABLE_LOG_RING && (level) >= logLevelThreshold) logEvent(level, __VA_ARGS__); } while (0)
+
+void logEvent(LogLevel level, LogMessageId id, int32_t a0 = 0, int32_t a1 = 0, int32_t a2 = 0,
+              int32_t a3 = 0, int32_t a4 = 0, int32_t a5 = 0);
+int drainLogRing(int maxRecords);
+
+#endif // LOG_RING_H
@@ -0,0 +1,34 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "common.h"
+#include <atomic>
+#include <WebSocketsClient.h>
+
+// Fleet metrics served as Prometheus text on http://<deck>:METRICS_PORT/metrics.
+// Hot paths only bump relaxed atomics, and the server runs in its own idle priority
+// task that blocks in accept(), so a scrape never waits on or holds a lock used by
+// the loop or button tasks.
+
+#define METRICS_PORT 9100
+#define METRICS_RESPONSE_SIZE 6144
+#define METRICS_TASK_STACK_SIZE 4096
+#define METRICS_PARSE_BUCKETS 6 // Upper bounds in metricsParseBucketMicros, plus +Inf
+
+enum MetricsFrameType : uint8_t {
+    METRICS_FRAME_TEXT,
+    METRICS_FRAME_BINARY,
+    METRICS_FRAME_FRAGMENT,
+    METRICS_FRAME_PING,
+    METRICS_FRAME_PONG,
+    METRICS_FRAME_TYPES
+};
+
+void metricsRecordFrame(WStype_t type);
+void metricsRecordParse(unsigned long parseMicros);
+void metricsRecordShow(unsigned long showMicros);
+void metricsRecordKeyPress();
+void startMetricsServer();
+size_t formatMetrics(char* buffer, size_t size);
+
+#endif // METRICS_H
@@ -0,0 +1,14 @@
+#ifndef NIGHT_MODE_H
+#define NIGHT_MODE_H
+
+#include "common.h"
+#include "config.h"
+#include "led_control.h"
+
+#define MINUTES_PER_DAY 1440
+#define NIGHT_MODE_CHECK_INTERVAL_MS 1000
+
+void initializeNightMode();
+void updateNightMode();
+
+#endif // NIGHT_MODE_H
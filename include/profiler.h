@@ -0,0 +1,52 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "common.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define PROFILER_SAMPLE_INTERVAL_MS 5000
+#define PROFILER_HISTORY_SIZE 8
+#define PROFILER_MAX_TASKS 16
+
+struct TaskProfile {
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t cpuPercent;           // 0 unless the core has configGENERATE_RUN_TIME_STATS
+    uint32_t stackHighWaterMark;  // bytes of stack never touched
+};
+
+struct ProfilerSample {
+    unsigned long timestamp;
+    uint32_t freeHeap;
+    uint32_t minFreeHeap;
+    uint32_t largestFreeBlock;
+    uint8_t fragmentation;  // percent of free heap not usable as one block
+    int queueDepth;
+    int queueHighWaterMark;
+    unsigned long droppedMessages;
+    uint32_t buttonTaskStackFree;
+    uint32_t loopTaskStackFree;
+    unsigned long stateMessages;
+    unsigned long stateBytes;
+    unsigned long stateHandleMicros;
+    unsigned long maxStateHandleMicros;
+    uint16_t loopWakeupsPerSecond;
+    uint16_t buttonWakeupsPerSecond;
+    unsigned long maxKeyWakeMicros;  // From key interrupt to the button task scanning
+    unsigned long maxLedFrameMicros; // Longest fade frame, including starting strip.show()
+    uint8_t numTasks;
+    TaskProfile tasks[PROFILER_MAX_TASKS];
+};
+
+extern ProfilerSample profilerSamples[PROFILER_HISTORY_SIZE];
+extern int profilerSampleCount;
+
+void sampleProfiler();
+void printProfilerReport();
+void profilerRecordStateMessage(size_t bytes, unsigned long handleMicros);
+void profilerRecordLoopWakeup();
+void profilerRecordButtonWakeup();
+void profilerRecordKeyWake(unsigned long latencyMicros);
+void profilerRecordLedFrame(unsigned long frameMicros);
+
+#endif // PROFILER_H
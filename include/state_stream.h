@@ -0,0 +1,24 @@
+#ifndef STATE_STREAM_H
+#define STATE_STREAM_H
+
+#include "common.h"
+#include "config.h"
+#include "json_stream.h"
+#include "entity_state.h"
+#include "led_control.h"
+#include "compact_state.h"
+
+// Reads Home Assistant messages through the incremental tokenizer. Each entity in a
+// subscribe_entities event is applied to its LEDs as soon as its object closes, and a
+// render_template result is passed to the compact state parser as it arrives, so a
+// snapshot never has to be held in memory as a whole.
+
+void beginStateStream();
+bool feedStateStream(const uint8_t* data, size_t length);
+bool finishStateStream();
+bool isStateStreamOpen();
+const char* stateStreamMessageType(); // "type" of the last message, e.g. "auth_ok" or "event"
+unsigned long stateStreamMessageId(); // "id" of the last message, 0 if it had none
+bool stateStreamMessageSucceeded();   // "success" of the last message, false if it had none
+
+#endif // STATE_STREAM_H
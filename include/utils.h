@@ -4,6 +4,7 @@
 #include "common.h"
 
 void printMemoryUsage();
+void handleSerialCommands();
 
 
 #endif // UTILS_H
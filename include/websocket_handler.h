@@ -11,8 +11,41 @@
 #include "animations.h"
 #include "secrets.h"
 #include "homeassistant_handler.h"
+#include "boot_timeline.h"
+#include "metrics.h"
 
-extern WebSocketsClient webSocket;
+#define WEBSOCKET_RECONNECT_INTERVAL_MS 5000
+#define WEBSOCKET_BOOT_RECONNECT_INTERVAL_MS 500 // Retries until the first connection, so boot isn't held up by a slow server start
+// With standby endpoints, an endpoint is given up on when it makes no progress for this long: no socket
+// after begin(), no upgrade after the socket opened, or no auth_ok after the upgrade. The blocking
+// connect and TLS handshake are not counted, so slow handshakes don't cause a failover.
+#define WEBSOCKET_FAILOVER_TIMEOUT_MS 3000
+
+struct HaEndpoint {
+    const char* host;
+    uint16_t port;
+};
+
+// Exposes the connection's socket so the loop task can block until it is readable
+class DeckWebSocketsClient : public WebSocketsClient {
+public:
+    int socketFd();
+    bool hasBufferedData();
+    bool serverCertificateMatches(const char* fingerprint);
+};
+
+extern DeckWebSocketsClient webSocket;
+
+// Cost of the last connect (TCP, plus the TLS handshake with HA_USE_TLS), measured around the
+// webSocket.loop() call that opened the socket. The ESP32 core's WiFiClientSecure doesn't
+// expose TLS sessions, so every reconnect is a full handshake.
+extern unsigned long webSocketConnectMicros;
+extern unsigned long webSocketMaxConnectMicros;
+extern long webSocketConnectHeapBytes; // Heap still held by the connection once it is open
+extern unsigned long webSocketConnects;
+extern unsigned long webSocketFailovers;
+extern unsigned long webSocketFailoverMillis; // From losing the last endpoint until the next one authenticated
+extern int webSocketEndpoint;                 // Index into HA_HOST followed by HA_STANDBY_ENDPOINTS
 
 struct QueuedMessage {
     char* payload;
@@ -20,9 +53,14 @@ struct QueuedMessage {
 };
 
 extern QueuedMessage queuedMessages[MAX_QUEUED_MESSAGES];
+extern volatile int queuedMessageHighWaterMark;
+extern volatile unsigned long droppedMessageCount;
 
 void initializeWebSocket();
 void reconnectWebSocket();
+void failOverWebSocket();
+void webSocketAuthenticated();
+void serviceWebSocket();
 void webSocketEvent(WStype_t type, uint8_t * payload, size_t length);
 void queueWebSocketMessage(uint8_t* payload, size_t length);
 void processQueuedMessages();
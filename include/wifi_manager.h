@@ -5,8 +5,12 @@
 #include <WiFi.h>
 #include "secrets.h"
 
+#define WIFI_CONNECT_TIMEOUT_MS 10000 // Show the failure animation and start over after this long without a connection
 
-bool connectToWiFi(unsigned long timeout);
-
+// Association and DHCP run in the WiFi driver's own task; the loop task only checks
+// on them when a WiFi event wakes it, so nothing waits for the radio.
+void startWiFi();
+bool serviceWiFi(); // True when the connection has just come up
+unsigned long wifiNextDue();
 
 #endif // WIFI_MANAGER_H
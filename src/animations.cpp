@@ -1,84 +1,142 @@
 #include "animations.h"
 
-void showConnectingAnimation() {
-    SERIAL_PRINTLN("Showing connecting animation (Blue)");
-    for (int i = 0; i < NUM_LEDS; i++) {
-        strip.setPixelColor(i, applyBrightnessScalar(COLOR_BLUE));
-        strip.show();
-        delay(ANIMATION_DELAY_SHORT);
+// Overlay state is written by the loop task while holding xMutex, so updateLEDState
+// (which also holds it) never draws a key in the middle of an overlay frame
+static volatile OverlayAnimation overlayAnimation = OVERLAY_NONE;
+static unsigned long overlayStartTime = 0;
+static int overlayFrame = -1;
+
+static unsigned long overlayFrameInterval(OverlayAnimation animation) {
+    switch (animation) {
+        case OVERLAY_CONNECTING:
+            return ANIMATION_DELAY_SHORT;
+        case OVERLAY_CHILD_LOCK_ENABLED:
+        case OVERLAY_CHILD_LOCK_DISABLED:
+            return CHILD_LOCK_BLINK_MS;
+        default:
+            return ANIMATION_DELAY_MEDIUM;
     }
+}
+
+// Number of frames, or 0 for an overlay that repeats until it is replaced
+static int overlayFrameCount(OverlayAnimation animation) {
+    return animation == OVERLAY_CONNECTING ? 0 : ANIMATION_REPEAT_COUNT * 2;
+}
+
+static void drawOverlayFrame(OverlayAnimation animation, int frame) {
     strip.clear();
+    if (animation == OVERLAY_CONNECTING) {
+        // Blue fills up one key at a time, then starts over
+        for (int i = 0; i <= frame % NUM_LEDS; i++) {
+            strip.setPixelColor(i, applyBrightnessScalar(COLOR_BLUE));
+        }
+    } else if (frame % 2 == 0) {
+        for (int i = 0; i < NUM_LEDS; i++) {
+            if (animation == OVERLAY_WIFI_CONNECTED) {
+                strip.setPixelColor(i, applyBrightnessScalar(COLOR_GREEN));
+            } else if (animation == OVERLAY_CHILD_LOCK_ENABLED) {
+                strip.setPixelColor(i, applyBrightnessScalar(COLOR_PURPLE));
+            } else if (animation == OVERLAY_CHILD_LOCK_DISABLED) {
+                strip.setPixelColor(i, applyBrightnessScalar(COLOR_WHITE));
+            } else {
+                strip.setPixelColor(i, applyBrightnessScalar(i % 2 == 0 ? COLOR_CYAN : COLOR_YELLOW));
+            }
+        }
+    }
     strip.show();
 }
 
-void showWiFiConnectedAnimation() {
-    SERIAL_PRINTLN("Showing WiFi connected animation (Green)");
-    for (int i = 0; i < ANIMATION_REPEAT_COUNT; i++) {
-        for (int j = 0; j < NUM_LEDS; j++) {
-            strip.setPixelColor(j, applyBrightnessScalar(COLOR_GREEN));
+// Shows every key's own state again once an overlay is gone
+static void redrawKeys() {
+    for (int y = 0; y < ROWS; y++) {
+        for (int x = 0; x < COLS; x++) {
+            updateLED(x, y);
         }
-        strip.show();
-        delay(ANIMATION_DELAY_MEDIUM);
-        strip.clear();
-        strip.show();
-        delay(ANIMATION_DELAY_MEDIUM);
     }
 }
 
-void showWebSocketConnectedAnimation() {
-    SERIAL_PRINTLN("Showing WebSocket connected animation (Cyan and Yellow)");
-    for (int i = 0; i < ANIMATION_REPEAT_COUNT; i++) {
-        for (int j = 0; j < NUM_LEDS; j++) {
-            strip.setPixelColor(j, applyBrightnessScalar(j % 2 == 0 ? COLOR_CYAN : COLOR_YELLOW));
-        }
-        strip.show();
-        delay(ANIMATION_DELAY_MEDIUM);
-        strip.clear();
-        strip.show();
-        delay(ANIMATION_DELAY_MEDIUM);
+void startOverlayAnimation(OverlayAnimation animation) {
+    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
+        fadeCancelAll();
+        overlayAnimation = animation;
+        overlayStartTime = millis();
+        overlayFrame = -1;
+        xSemaphoreGive(xMutex);
     }
 }
 
-void showConnectionFailedAnimation() {
-    SERIAL_PRINTLN("Showing connection failed animation (Red)");
-    strip.clear();
-    for (int j = 0; j < NUM_LEDS; j++) {
-        strip.setPixelColor(j, applyBrightnessScalar(COLOR_RED));
+// Drops the overlay without redrawing, for callers that paint the whole strip themselves
+void cancelOverlayAnimation() {
+    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
+        overlayAnimation = OVERLAY_NONE;
+        xSemaphoreGive(xMutex);
     }
-    strip.show();
 }
 
-void showWebSocketConnectionFailedAnimation() {
-    SERIAL_PRINTLN("Showing WebSocket connection failed animation (Red and Orange)");
-    strip.clear();
-    for (int j = 0; j < NUM_LEDS; j++) {
-        strip.setPixelColor(j, applyBrightnessScalar(j % 2 == 0 ? COLOR_RED : COLOR_ORANGE));
+bool overlayActive() {
+    return overlayAnimation != OVERLAY_NONE;
+}
+
+unsigned long overlayNextDue() {
+    if (!overlayActive()) {
+        return ULONG_MAX;
     }
-    strip.show();
+    unsigned long interval = overlayFrameInterval(overlayAnimation);
+    unsigned long nextFrameTime = overlayStartTime + (overlayFrame + 1) * interval;
+    long remaining = (long)(nextFrameTime - millis());
+    return remaining > 0 ? remaining : 0;
 }
 
-void showChildLockEnabledAnimation() {
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < strip.numPixels(); j++) {
-            strip.setPixelColor(j, applyBrightnessScalar(COLOR_PURPLE)); 
+// Called by the loop task; draws the overlay's current frame and ends it when it has played out
+void renderOverlayFrame() {
+    if (!overlayActive()) {
+        return;
+    }
+    if (isBrightnessUpdateInProgress) {
+        cancelOverlayAnimation(); // The adjustment owns the strip and restores the keys when it ends
+        return;
+    }
+
+    bool finished = false;
+    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
+        OverlayAnimation animation = overlayAnimation;
+        int frame = (millis() - overlayStartTime) / overlayFrameInterval(animation);
+        int frameCount = overlayFrameCount(animation);
+        if (frameCount > 0 && frame >= frameCount) {
+            overlayAnimation = OVERLAY_NONE;
+            finished = true;
+        } else if (frame != overlayFrame) {
+            drawOverlayFrame(animation, frame);
+            overlayFrame = frame;
         }
-        strip.show();
-        delay(200);
-        strip.clear();
-        strip.show();
-        delay(200);
+        xSemaphoreGive(xMutex);
+    }
+
+    if (finished) {
+        redrawKeys();
     }
 }
 
-void showChildLockDisabledAnimation() {
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < strip.numPixels(); j++) {
-            strip.setPixelColor(j, applyBrightnessScalar(COLOR_WHITE)); 
+// Covers every key with a failure pattern. Held under xMutex like the overlay, and running fades
+// are stopped so the next LED frame doesn't paint them back over the pattern.
+static void showFailurePattern(uint32_t evenColor, uint32_t oddColor) {
+    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
+        overlayAnimation = OVERLAY_NONE;
+        fadeCancelAll();
+        for (int j = 0; j < NUM_LEDS; j++) {
+            strip.setPixelColor(j, applyBrightnessScalar(j % 2 == 0 ? evenColor : oddColor));
         }
         strip.show();
-        delay(200);
-        strip.clear();
-        strip.show();
-        delay(200);
+        xSemaphoreGive(xMutex);
     }
 }
+
+void showConnectionFailedAnimation() {
+    SERIAL_PRINTLN("Showing connection failed animation (Red)");
+    showFailurePattern(COLOR_RED, COLOR_RED);
+}
+
+void showWebSocketConnectionFailedAnimation() {
+    SERIAL_PRINTLN("Showing WebSocket connection failed animation (Red and Orange)");
+    showFailurePattern(COLOR_RED, COLOR_ORANGE);
+}
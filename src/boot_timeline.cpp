@@ -0,0 +1,38 @@
+#include "boot_timeline.h"
+
+volatile unsigned long bootStageMillis[BOOT_STAGE_COUNT] = {0};
+
+static const char* const bootStageNames[BOOT_STAGE_COUNT] = {
+    "keys scanning", "wifi up", "websocket connected", "authenticated", "state restored"
+};
+
+// Only the first time a stage is reached counts; reconnects later on don't move it
+void bootMark(BootStage stage) {
+    if (bootStageMillis[stage] != 0) {
+        return;
+    }
+    bootStageMillis[stage] = max(millis(), 1UL);
+    SERIAL_PRINTF("Boot: %s at %lu ms\n", bootStageNames[stage], bootStageMillis[stage]);
+
+    unsigned long usable = bootToFirstUsableKeyMs();
+    if (usable != 0 && (stage == BOOT_KEYS_SCANNING || stage == BOOT_AUTHENTICATED || stage == BOOT_STATE_RESTORED)) {
+        SERIAL_PRINTF("Boot to first usable key: %lu ms\n", usable);
+    }
+}
+
+unsigned long bootToFirstUsableKeyMs() {
+    unsigned long scanning = bootStageMillis[BOOT_KEYS_SCANNING];
+    unsigned long authenticated = bootStageMillis[BOOT_AUTHENTICATED];
+    unsigned long restored = bootStageMillis[BOOT_STATE_RESTORED];
+    if (scanning == 0 || authenticated == 0 || restored == 0) {
+        return 0;
+    }
+    return max(scanning, max(authenticated, restored));
+}
+
+void printBootTimeline() {
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+        Serial.printf("Boot %s: %lu ms\n", bootStageNames[i], bootStageMillis[i]);
+    }
+    Serial.printf("Boot to first usable key: %lu ms\n", bootToFirstUsableKeyMs());
+}
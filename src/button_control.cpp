@@ -5,6 +5,173 @@
 extern bool isChildLockMode;
 extern unsigned long childLockButtonPressTime;
 
+static bool hasDoubleTapAction(int x, int y) {
+    int index = findMappingIndex(x, y);
+    return index >= 0 && entityMappings[index].double_tap_action != GESTURE_ACTION_NONE;
+}
+
+void initializeGestures() {
+    for (int y = 0; y < ROWS; y++) {
+        for (int x = 0; x < COLS; x++) {
+            gestureInit(gestureKeys[y][x], hasDoubleTapAction(x, y));
+        }
+    }
+}
+
+static volatile unsigned long keyInterruptMicros = 0;
+// colPins lives in flash, which the ISR can't read while a flash write has the cache disabled
+static DRAM_ATTR uint32_t keyInterruptPins[COLS];
+
+// Runs from IRAM and only touches IRAM-safe code: the GPIO low level call is inlined, and
+// micros() and the FreeRTOS ISR functions are placed in IRAM by the core
+static void IRAM_ATTR keyInterrupt() {
+    // Level triggered, so silence every column until the task has taken over scanning
+    for (int x = 0; x < COLS; x++) {
+        gpio_ll_intr_disable(&GPIO, keyInterruptPins[x]);
+    }
+    keyInterruptMicros = micros();
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(buttonTaskHandle, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+// True when no key is down and nothing is waiting on a timeout, so scanning can stop
+static bool keysIdle() {
+    if (upButtonPressed || downButtonPressed || isBrightnessAdjustmentMode) {
+        return false;
+    }
+    for (int y = 0; y < ROWS; y++) {
+        for (int x = 0; x < COLS; x++) {
+            if (buttonState[y][x] || lastButtonState[y][x] || !gestureIdle(gestureKeys[y][x])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Drives every row low so any key pulls its column low, then blocks until one does
+static void waitForKeyPress() {
+    for (int y = 0; y < ROWS; y++) {
+        pinMode(rowPins[y], OUTPUT);
+        digitalWrite(rowPins[y], LOW);
+    }
+    for (int x = 0; x < COLS; x++) {
+        pinMode(colPins[x], INPUT_PULLUP);
+        keyInterruptPins[x] = colPins[x];
+        attachInterrupt(colPins[x], keyInterrupt, ONLOW);
+        if (ENABLE_LIGHT_SLEEP) {
+            gpio_wakeup_enable((gpio_num_t)colPins[x], GPIO_INTR_LOW_LEVEL);
+        }
+    }
+
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    for (int x = 0; x < COLS; x++) {
+        detachInterrupt(colPins[x]);
+        if (ENABLE_LIGHT_SLEEP) {
+            gpio_wakeup_disable((gpio_num_t)colPins[x]);
+        }
+        pinMode(colPins[x], INPUT);
+    }
+    for (int y = 0; y < ROWS; y++) {
+        pinMode(rowPins[y], INPUT);
+    }
+    profilerRecordKeyWake(micros() - keyInterruptMicros);
+}
+
+static void dispatchGestures(int x, int y, uint8_t events) {
+    if (isChildLockMode || upButtonPressed || downButtonPressed) {
+        return;
+    }
+
+    int index = findMappingIndex(x, y);
+    if (index < 0) {
+        return;
+    }
+    const EntityMapping& mapping = entityMappings[index];
+
+    if (events & GESTURE_TAP) {
+        toggleEntity(x, y);
+    }
+    if (events & GESTURE_DOUBLE_TAP) {
+        SERIAL_PRINTF("Double tap detected at (x: %d, y: %d)\n", x, y);
+        performGestureAction(x, y, mapping.double_tap_action);
+    }
+    if ((events & GESTURE_HOLD) && mapping.hold_action != GESTURE_ACTION_NONE) {
+        SERIAL_PRINTF("Hold detected at (x: %d, y: %d)\n", x, y);
+        performGestureAction(x, y, mapping.hold_action);
+    }
+    if (events & GESTURE_LONG_PRESS) {
+        SERIAL_PRINTF("Long press detected at (x: %d, y: %d)\n", x, y);
+        if (mapping.long_press_action != GESTURE_ACTION_NONE) {
+            performGestureAction(x, y, mapping.long_press_action);
+        }
+    }
+}
+
+// Level each held key is being moved to while up or down is held. Every key has its own
+// session, so several lights and speakers can be adjusted together
+struct AdjustmentSession {
+    bool active;
+    int level;                  // 0-255, volume is scaled to the same range
+    unsigned long lastStepTime;
+};
+static AdjustmentSession adjustmentSessions[ROWS][COLS];
+
+// Draws one bar per adjusted key, each in that key's colour
+static void showAdjustmentLevels() {
+    LevelBar bars[ROWS * COLS];
+    int count = 0;
+    for (int y = 0; y < ROWS; y++) {
+        for (int x = 0; x < COLS; x++) {
+            if (!adjustmentSessions[y][x].active) {
+                continue;
+            }
+            EntityState state = readKeyState(x, y);
+            bars[count].level = adjustmentSessions[y][x].level;
+            bars[count].r = state.r;
+            bars[count].g = state.g;
+            bars[count].b = state.b;
+            count++;
+        }
+    }
+    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
+        displayLevelBars(bars, count);
+        xSemaphoreGive(xMutex);
+    } else {
+        LOG_EVENT(LOG_LEVEL_ERROR, LOG_ADJUST_MUTEX_FAILED);
+    }
+}
+
+static void clearAdjustments() {
+    memset(adjustmentSessions, 0, sizeof(adjustmentSessions));
+    isBrightnessAdjustmentMode = false;
+}
+
+// Sends the levels every adjusted key ended on, queued together so they leave as one message
+static void commitAdjustments() {
+    int mappings[ROWS * COLS];
+    int levels[ROWS * COLS];
+    int count = 0;
+    for (int y = 0; y < ROWS; y++) {
+        for (int x = 0; x < COLS; x++) {
+            int index = findMappingIndex(x, y);
+            if (!adjustmentSessions[y][x].active || index < 0) {
+                continue;
+            }
+            mappings[count] = index;
+            levels[count] = adjustmentSessions[y][x].level; // Volume is sent as a 0-255 level too
+            count++;
+        }
+    }
+    if (count > 0) {
+        SERIAL_PRINTF("Sending final brightness or volume update for %d entities\n", count);
+        sendBrightnessOrVolumeUpdates(mappings, levels, count);
+    }
+    clearAdjustments();
+}
+
 void buttonCheckTask(void * parameter) {
     SERIAL_PRINTLN("Button check task started");
     printMemoryUsage();
@@ -14,7 +181,9 @@ void buttonCheckTask(void * parameter) {
     xLastWakeTime = xTaskGetTickCount();
 
     bool childLockButtonsPressed = false;
+    bool childLockToggled = false; // Once per hold, now that the animation doesn't block scanning
     unsigned long childLockPressStartTime = 0;
+    bool pageButtonsPressed = false;
 
     while (true) {
         esp_task_wdt_reset(); // Reset watchdog timer
@@ -25,12 +194,25 @@ void buttonCheckTask(void * parameter) {
             if (!childLockButtonsPressed) {
                 childLockButtonsPressed = true;
                 childLockPressStartTime = millis();
-            } else if (millis() - childLockPressStartTime >= CHILD_LOCK_ACTIVATION_TIME) {
+            } else if (!childLockToggled && millis() - childLockPressStartTime >= CHILD_LOCK_ACTIVATION_TIME) {
                 toggleChildLock();
-                childLockButtonsPressed = false;
+                childLockToggled = true;
             }
         } else {
             childLockButtonsPressed = false;
+            childLockToggled = false;
+        }
+
+        // Switch pages as soon as both page buttons are down
+        if (NUM_PAGES > 1 &&
+            buttonState[PAGE_BUTTON1_Y][PAGE_BUTTON1_X] &&
+            buttonState[PAGE_BUTTON2_Y][PAGE_BUTTON2_X]) {
+            if (!pageButtonsPressed && !isChildLockMode) {
+                switchToNextPage();
+            }
+            pageButtonsPressed = true;
+        } else {
+            pageButtonsPressed = false;
         }
 
         for (int y = 0; y < ROWS; y++) {
@@ -51,6 +233,7 @@ void buttonCheckTask(void * parameter) {
 
                         if (buttonState[y][x] == true) {
                             buttonPressTime[y][x] = millis();
+                            metricsRecordKeyPress();
 
                             if (x == UP_BUTTON_X && y == UP_BUTTON_Y) {
                                 upButtonPressed = true;
@@ -62,27 +245,25 @@ void buttonCheckTask(void * parameter) {
                                 upButtonPressed = false;
                             } else if (x == DOWN_BUTTON_X && y == DOWN_BUTTON_Y) {
                                 downButtonPressed = false;
-                            } else {
-                                unsigned long pressDuration = millis() - buttonPressTime[y][x];
-                                
-                                if (!isChildLockMode || pressDuration >= LONG_PRESS_TIME) {
-                                    if (pressDuration < LONG_PRESS_TIME && !upButtonPressed && !downButtonPressed) {
-                                        toggleEntity(x, y);
-                                    } else {
-                                        SERIAL_PRINTF("Long press detected at (x: %d, y: %d)\n", x, y);
-                                    }
-                                }
                             }
                         }
                     }
                 }
 
+                if (!(x == UP_BUTTON_X && y == UP_BUTTON_Y) && !(x == DOWN_BUTTON_X && y == DOWN_BUTTON_Y)) {
+                    uint8_t events = gestureUpdate(gestureKeys[y][x], buttonState[y][x], millis());
+                    if (events) {
+                        dispatchGestures(x, y, events);
+                    }
+                }
+
                 lastButtonState[y][x] = reading;
                 pinMode(colPins[x], INPUT);
             }
 
             pinMode(rowPins[y], INPUT);
         }
+        bootMark(BOOT_KEYS_SCANNING);
 
         if ((upButtonPressed || downButtonPressed) && (millis() - lastBrightnessAdjustTime > BRIGHTNESS_ADJUST_INTERVAL)) {
             SERIAL_PRINTLN("Entering brightness adjustment block");
@@ -90,14 +271,17 @@ void buttonCheckTask(void * parameter) {
             unsigned long adjustmentStartTime = millis();
 
             while ((upButtonPressed || downButtonPressed) && (millis() - adjustmentStartTime <= BRIGHTNESS_UPDATE_TIMEOUT_MS)) {
+                bool stepped = false;
                 for (int y = 0; y < ROWS; y++) {
                     for (int x = 0; x < COLS; x++) {
                         if (buttonState[y][x] && !(x == UP_BUTTON_X && y == UP_BUTTON_Y) && !(x == DOWN_BUTTON_X && y == DOWN_BUTTON_Y)) {
-                            SERIAL_PRINTF("Calling adjustBrightnessOrVolume for button at (%d, %d)\n", x, y);
-                            adjustBrightnessOrVolume(x, y, upButtonPressed);
+                            stepped |= adjustBrightnessOrVolume(x, y, upButtonPressed);
                         }
                     }
                 }
+                if (stepped) {
+                    showAdjustmentLevels();
+                }
 
                 // Add a small delay to prevent overwhelming the system
                 vTaskDelay(pdMS_TO_TICKS(10));
@@ -108,42 +292,31 @@ void buttonCheckTask(void * parameter) {
 
             lastBrightnessAdjustTime = millis();
             isBrightnessUpdateInProgress = false;
+            notifyLoopTask(); // Messages queued during the adjustment can be handled now
+
+            // Keys held for the adjustment must not fire taps or holds once it ends
+            for (int y = 0; y < ROWS; y++) {
+                for (int x = 0; x < COLS; x++) {
+                    gestureCancel(gestureKeys[y][x]);
+                }
+            }
             if (millis() - adjustmentStartTime > BRIGHTNESS_UPDATE_TIMEOUT_MS) {
                 SERIAL_PRINTLN("Brightness adjustment timeout reached");
-                isBrightnessAdjustmentMode = false;
-                restoreStates();
+                clearAdjustments();
+                showPage(currentPage); // Puts the keys back over the level bars
             } else {
                 // Finalize the brightness adjustment
-                for (int i = 0; i < NUM_MAPPINGS; i++) {
-                    if (entityMappings[i].x == lastAdjustedX && entityMappings[i].y == lastAdjustedY) {
-                        SERIAL_PRINTF("Sending final brightness or volume update for entity at (%d, %d)\n", lastAdjustedX, lastAdjustedY);
-                        if (isMediaPlayer(entityMappings[i].entity_id)) {
-                            sendBrightnessOrVolumeUpdate(entityMappings[i].entity_id, entityStates[lastAdjustedY][lastAdjustedX].volume * 255, true);
-                        } else {
-                            sendBrightnessOrVolumeUpdate(entityMappings[i].entity_id, currentAdjustmentBrightness, false);
-                        }
-                        break;
-                    }
-                }
+                commitAdjustments();
+                showPage(currentPage); // Puts the keys back over the level bars
             }
             SERIAL_PRINTLN("Exiting brightness adjustment block");
         } else if (!upButtonPressed && !downButtonPressed && isBrightnessAdjustmentMode) {
             SERIAL_PRINTLN("Finalizing brightness adjustment");
             isBrightnessUpdateInProgress = true;
-            for (int i = 0; i < NUM_MAPPINGS; i++) {
-                if (entityMappings[i].x == lastAdjustedX && entityMappings[i].y == lastAdjustedY) {
-                    SERIAL_PRINTF("Sending final brightness or volume update for entity at (%d, %d)\n", lastAdjustedX, lastAdjustedY);
-                    if (isMediaPlayer(entityMappings[i].entity_id)) {
-                        sendBrightnessOrVolumeUpdate(entityMappings[i].entity_id, entityStates[lastAdjustedY][lastAdjustedX].volume * 255, true);
-                    } else {
-                        sendBrightnessOrVolumeUpdate(entityMappings[i].entity_id, currentAdjustmentBrightness, false);
-                    }
-                    break;
-                }
-            }
-            isBrightnessAdjustmentMode = false;
+            commitAdjustments();
             isBrightnessUpdateInProgress = false;
-            restoreStates();
+            notifyLoopTask();
+            showPage(currentPage); // Puts the keys back over the level bars
             SERIAL_PRINTLN("Brightness adjustment finalized");
         }
 
@@ -154,94 +327,68 @@ void buttonCheckTask(void * parameter) {
             lastTaskMemoryPrint = millis();
         }
 
-        vTaskDelayUntil(&xLastWakeTime, xFrequency);
-        vTaskDelay(pdMS_TO_TICKS(10)); // Add a small delay to prevent task starvation
+        if (keysIdle()) {
+            waitForKeyPress();
+            xLastWakeTime = xTaskGetTickCount();
+        } else {
+            vTaskDelayUntil(&xLastWakeTime, xFrequency);
+            vTaskDelay(pdMS_TO_TICKS(10)); // Add a small delay to prevent task starvation
+        }
+        profilerRecordButtonWakeup();
     }
 }
 
+// Steps the level of the key at (x, y) and returns true when it changed; the caller draws it
 bool adjustBrightnessOrVolume(int x, int y, bool increase) {
-    SERIAL_PRINTF("Entering adjustBrightnessOrVolume: x=%d, y=%d, increase=%d\n", x, y, increase);
-    static unsigned long lastAdjustmentTime = 0;
-    const unsigned long ADJUSTMENT_INTERVAL = 50; // 20ms for both brightness and volume
+    LOG_EVENT(LOG_LEVEL_DEBUG, LOG_ADJUST_ENTER, x, y, increase);
+    const unsigned long ADJUSTMENT_INTERVAL = 50; // 50ms for both brightness and volume
     const int ADJUSTMENT_STEP = 5; // Small step for smooth adjustments
 
     // Add this check at the beginning of the function
     if (isChildLockMode) {
-        SERIAL_PRINTLN("Child lock mode active, ignoring brightness/volume adjustment");
+        LOG_EVENT(LOG_LEVEL_INFO, LOG_ADJUST_CHILD_LOCK);
         return false;
     }
 
-    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
-        SERIAL_PRINTLN("Mutex acquired in adjustBrightnessOrVolume");
-        for (int i = 0; i < NUM_MAPPINGS; i++) {
-            if (entityMappings[i].x == x && entityMappings[i].y == y) {
-                SERIAL_PRINTF("Found matching entity mapping at index %d\n", i);
-                
-                const char* entity_id = entityMappings[i].entity_id;
-                
-                if (isSwitch(entity_id)) {
-                    SERIAL_PRINTLN("Entity is a switch, skipping brightness/volume adjustment");
-                    xSemaphoreGive(xMutex);
-                    return false;
-                }
-
-                if (!isLight(entity_id) && !isMediaPlayer(entity_id)) {
-                    SERIAL_PRINTLN("Entity is neither a light nor a media player, skipping adjustment");
-                    xSemaphoreGive(xMutex);
-                    return false;
-                }
-
-                if (!isBrightnessAdjustmentMode) {
-                    SERIAL_PRINTLN("Entering adjustment mode");
-                    isBrightnessAdjustmentMode = true;
-                    saveCurrentStates();
-                    currentAdjustmentBrightness = isMediaPlayer(entity_id) ? 
-                        entityStates[y][x].volume * 255 : entityStates[y][x].brightness;
-                    brightnessAdjustmentStartTime = millis();
-                    lastAdjustedX = x;
-                    lastAdjustedY = y;
-                }
-
-                unsigned long currentTime = millis();
-
-                if (currentTime - lastAdjustmentTime >= ADJUSTMENT_INTERVAL) {
-                    if (increase) {
-                        currentAdjustmentBrightness = min(255, currentAdjustmentBrightness + ADJUSTMENT_STEP);
-                    } else {
-                        currentAdjustmentBrightness = max(0, currentAdjustmentBrightness - ADJUSTMENT_STEP);
-                    }
-                    SERIAL_PRINTF("Adjusted value to %d\n", currentAdjustmentBrightness);
-
-                    if (isMediaPlayer(entity_id)) {
-                        entityStates[y][x].volume = currentAdjustmentBrightness / 255.0f;
-                        SERIAL_PRINTF("Adjusted volume to %.2f\n", entityStates[y][x].volume);
-                    } else {
-                        entityStates[y][x].brightness = currentAdjustmentBrightness;
-                    }
+    int index = findMappingIndex(x, y);
+    if (index < 0) {
+        return false;
+    }
+    const char* entity_id = entityMappings[index].entity_id;
 
-                    displayBrightnessLevel(currentAdjustmentBrightness, 
-                                           entityStates[y][x].r, 
-                                           entityStates[y][x].g, 
-                                           entityStates[y][x].b);
+    if (isSwitch(entity_id)) {
+        LOG_EVENT(LOG_LEVEL_DEBUG, LOG_ADJUST_SKIP_SWITCH, x, y);
+        return false;
+    }
 
-                    lastAdjustmentTime = currentTime;
+    if (!isLight(entity_id) && !isMediaPlayer(entity_id)) {
+        LOG_EVENT(LOG_LEVEL_DEBUG, LOG_ADJUST_SKIP_UNSUPPORTED, x, y);
+        return false;
+    }
 
-                    // Add a small delay after each adjustment
-                    delay(1);
-                }
+    // The level being set is only previewed; the key's state changes when Home Assistant reports it
+    AdjustmentSession& session = adjustmentSessions[y][x];
+    unsigned long currentTime = millis();
+    if (!session.active) {
+        EntityState state = readKeyState(x, y);
+        session.active = true;
+        session.level = isMediaPlayer(entity_id) ? state.volume * 255 : state.brightness;
+        session.lastStepTime = currentTime - ADJUSTMENT_INTERVAL; // The first step is immediate
+        isBrightnessAdjustmentMode = true;
+        LOG_EVENT(LOG_LEVEL_INFO, LOG_ADJUST_MODE_ENTER, x, y, session.level);
+    }
 
-                xSemaphoreGive(xMutex);
-                SERIAL_PRINTLN("Mutex released in adjustBrightnessOrVolume");
-                return true;
-            }
-        }
-        xSemaphoreGive(xMutex);
-        SERIAL_PRINTLN("Mutex released in adjustBrightnessOrVolume");
+    if (currentTime - session.lastStepTime < ADJUSTMENT_INTERVAL) {
+        return false;
+    }
+    if (increase) {
+        session.level = min(255, session.level + ADJUSTMENT_STEP);
     } else {
-        SERIAL_PRINTLN("Failed to acquire mutex in adjustBrightnessOrVolume");
+        session.level = max(0, session.level - ADJUSTMENT_STEP);
     }
-    SERIAL_PRINTLN("Exiting adjustBrightnessOrVolume");
-    return false;
+    session.lastStepTime = currentTime;
+    LOG_EVENT(LOG_LEVEL_DEBUG, LOG_ADJUST_VALUE, x, y, session.level);
+    return true;
 }
 
 // Add this new function to update button states
@@ -281,16 +428,28 @@ void updateButtonStates() {
 void toggleChildLock() {
     isChildLockMode = !isChildLockMode;
     SERIAL_PRINTF("Child lock mode %s\n", isChildLockMode ? "enabled" : "disabled");
-    if (isChildLockMode) {
-        showChildLockEnabledAnimation();
-    } else {
-        showChildLockDisabledAnimation();
+    // The lock keys have been held past their long press, which must not fire once they are
+    // released, and nothing started before the lock may finish under it
+    for (int y = 0; y < ROWS; y++) {
+        for (int x = 0; x < COLS; x++) {
+            gestureCancel(gestureKeys[y][x]);
+        }
     }
-    
-    // Show existing entity states after the animation
-    for (int row = 0; row < ROWS; row++) {
-        for (int col = 0; col < COLS; col++) {
-            updateLED(col, row);
+    // Drawn by the loop task, which redraws the keys when it ends, so scanning carries on meanwhile
+    startOverlayAnimation(isChildLockMode ? OVERLAY_CHILD_LOCK_ENABLED : OVERLAY_CHILD_LOCK_DISABLED);
+    notifyLoopTask();
+}
+
+void switchToNextPage() {
+    uint8_t page = (currentPage + 1) % NUM_PAGES;
+    SERIAL_PRINTF("Showing page %d\n", page);
+    showPage(page);
+    // The keys now belong to other entities, so nothing started on the old page may fire,
+    // including taps from the page buttons once they are released
+    for (int y = 0; y < ROWS; y++) {
+        for (int x = 0; x < COLS; x++) {
+            gestureKeys[y][x].multiTap = hasDoubleTapAction(x, y);
+            gestureCancel(gestureKeys[y][x]);
         }
     }
 }
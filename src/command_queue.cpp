@@ -0,0 +1,244 @@
+#include "command_queue.h"
+#include "event_loop.h"
+
+volatile unsigned long commandsDropped = 0;
+volatile unsigned long commandsExpired = 0;
+volatile unsigned long commandsSuperseded = 0;
+
+// Filled by the button task and drained by the loop task, both under commandQueueMutex
+static OutboundCommand commands[COMMAND_QUEUE_SIZE];
+static int commandCount = 0;
+static uint32_t nextSequence = 1;
+static volatile CommandLinkState linkState = COMMAND_LINK_DOWN;
+
+static CommandPriority commandPriority(CommandKind kind) {
+    switch (kind) {
+        case COMMAND_AUTH:
+        case COMMAND_SUBSCRIBE:
+            return COMMAND_PRIORITY_CONTROL;
+        case COMMAND_TOGGLE:
+        case COMMAND_GESTURE:
+            return COMMAND_PRIORITY_TOGGLE;
+        default:
+            return COMMAND_PRIORITY_LEVEL;
+    }
+}
+
+static void removeCommand(int index) {
+    commands[index] = commands[--commandCount];
+}
+
+// Queue order decides what to evict when full: the newest command of the least urgent priority
+static int evictionCandidate() {
+    int candidate = -1;
+    for (int i = 0; i < commandCount; i++) {
+        if (candidate < 0 ||
+            commandPriority(commands[i].kind) > commandPriority(commands[candidate].kind) ||
+            (commandPriority(commands[i].kind) == commandPriority(commands[candidate].kind) &&
+             commands[i].sequence > commands[candidate].sequence)) {
+            candidate = i;
+        }
+    }
+    return candidate;
+}
+
+// Called with commandQueueMutex held
+static bool insertCommand(CommandKind kind, int mapping, int value, GestureAction action) {
+    int slot = -1;
+    if (kind == COMMAND_LEVEL) {
+        for (int i = 0; i < commandCount; i++) {
+            if (commands[i].kind == COMMAND_LEVEL && commands[i].mapping == mapping) {
+                slot = i;
+                commandsSuperseded++;
+                break;
+            }
+        }
+    }
+    if (slot < 0 && commandCount < COMMAND_QUEUE_SIZE) {
+        slot = commandCount++;
+    }
+    if (slot < 0) {
+        int candidate = evictionCandidate();
+        if (commandPriority(commands[candidate].kind) >= commandPriority(kind)) {
+            slot = candidate;
+        }
+        commandsDropped++;
+    }
+    if (slot < 0) {
+        return false;
+    }
+
+    // A superseded level gets a new sequence, so a send of the old value can't remove it
+    OutboundCommand& command = commands[slot];
+    command.kind = kind;
+    command.mapping = mapping;
+    command.action = action;
+    command.value = value;
+    command.sequence = nextSequence++;
+    command.queuedTime = millis();
+    return true;
+}
+
+bool queueCommand(CommandKind kind, int mapping, int value, GestureAction action) {
+    bool queued = false;
+    if (xSemaphoreTake(commandQueueMutex, portMAX_DELAY) == pdTRUE) {
+        queued = insertCommand(kind, mapping, value, action);
+        xSemaphoreGive(commandQueueMutex);
+    }
+    if (queued) {
+        notifyLoopTask();
+    } else {
+        SERIAL_PRINTF("Outbound queue full, dropping command kind %d\n", kind);
+    }
+    return queued;
+}
+
+// Called with commandQueueMutex held
+static bool levelWaiting(int mapping) {
+    for (int i = 0; i < commandCount; i++) {
+        if (commands[i].kind == COMMAND_LEVEL && commands[i].mapping == mapping) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int insertLevels(const int* mappings, const int* values, int count, bool keepWaiting) {
+    int queued = 0;
+    if (xSemaphoreTake(commandQueueMutex, portMAX_DELAY) == pdTRUE) {
+        for (int i = 0; i < count; i++) {
+            if (keepWaiting && levelWaiting(mappings[i])) {
+                queued++; // A newer level for the key goes out anyway
+            } else if (insertCommand(COMMAND_LEVEL, mappings[i], values[i], GESTURE_ACTION_NONE)) {
+                queued++;
+            }
+        }
+        xSemaphoreGive(commandQueueMutex);
+    }
+    if (queued > 0) {
+        notifyLoopTask();
+    }
+    if (queued < count) {
+        SERIAL_PRINTF("Outbound queue full, dropping %d levels\n", count - queued);
+    }
+    return queued;
+}
+
+// Queues several levels at once, so the loop task can't send part of them before the rest arrive
+int queueLevels(const int* mappings, const int* values, int count) {
+    return insertLevels(mappings, values, count, false);
+}
+
+// Queues levels again after Home Assistant rejected them, except for keys that have a newer level waiting
+int requeueLevels(const int* mappings, const int* values, int count) {
+    return insertLevels(mappings, values, count, true);
+}
+
+void setCommandLinkState(CommandLinkState state) {
+    if (xSemaphoreTake(commandQueueMutex, portMAX_DELAY) == pdTRUE) {
+        if (state == COMMAND_LINK_DOWN) {
+            // Auth and subscribe are re-queued by the next connection
+            for (int i = commandCount - 1; i >= 0; i--) {
+                if (commandPriority(commands[i].kind) == COMMAND_PRIORITY_CONTROL) {
+                    removeCommand(i);
+                }
+            }
+        }
+        linkState = state;
+        xSemaphoreGive(commandQueueMutex);
+    }
+}
+
+static bool sendable(const OutboundCommand& command) {
+    if (commandPriority(command.kind) == COMMAND_PRIORITY_CONTROL) {
+        return linkState != COMMAND_LINK_DOWN;
+    }
+    return linkState == COMMAND_LINK_AUTHENTICATED;
+}
+
+// Drops expired commands and returns the next one to send, or -1
+static int nextCommand() {
+    unsigned long now = millis();
+    int next = -1;
+    for (int i = commandCount - 1; i >= 0; i--) {
+        if (commandPriority(commands[i].kind) != COMMAND_PRIORITY_CONTROL &&
+            now - commands[i].queuedTime > OFFLINE_COMMAND_TTL_MS) {
+            removeCommand(i);
+            commandsExpired++;
+        }
+    }
+    for (int i = 0; i < commandCount; i++) {
+        if (!sendable(commands[i])) {
+            continue;
+        }
+        if (next < 0 ||
+            commandPriority(commands[i].kind) < commandPriority(commands[next].kind) ||
+            (commandPriority(commands[i].kind) == commandPriority(commands[next].kind) &&
+             commands[i].sequence < commands[next].sequence)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+// Levels that are ready together, oldest first, when the next command is a level
+static int collectLevelBatch(int next, OutboundCommand* batch) {
+    if (commands[next].kind != COMMAND_LEVEL) {
+        return 0;
+    }
+    int count = 0;
+    for (int i = 0; i < commandCount && count < COMMAND_BATCH_SIZE; i++) {
+        if (commands[i].kind == COMMAND_LEVEL && sendable(commands[i])) {
+            int position = count++;
+            while (position > 0 && batch[position - 1].sequence > commands[i].sequence) {
+                batch[position] = batch[position - 1];
+                position--;
+            }
+            batch[position] = commands[i];
+        }
+    }
+    return count;
+}
+
+// Called by the loop task. The lock is not held while sending, since a send can block on TCP.
+// With a batch sender, every level waiting to be sent goes out in one message.
+void serviceCommandQueue(CommandSender send, CommandBatchSender sendLevels) {
+    while (true) {
+        OutboundCommand batch[COMMAND_BATCH_SIZE];
+        int count = 0;
+        if (xSemaphoreTake(commandQueueMutex, portMAX_DELAY) == pdTRUE) {
+            int index = nextCommand();
+            if (index >= 0) {
+                count = sendLevels ? collectLevelBatch(index, batch) : 0;
+                if (count == 0) {
+                    batch[0] = commands[index];
+                    count = 1;
+                }
+            }
+            xSemaphoreGive(commandQueueMutex);
+        }
+        if (count == 0) {
+            return;
+        }
+
+        bool sent = count > 1 ? sendLevels(batch, count) : send(batch[0]);
+        if (!sent) {
+            return; // Still queued, and retried once the connection is back
+        }
+        if (xSemaphoreTake(commandQueueMutex, portMAX_DELAY) == pdTRUE) {
+            for (int b = 0; b < count; b++) {
+                for (int i = 0; i < commandCount; i++) {
+                    if (commands[i].sequence == batch[b].sequence) {
+                        removeCommand(i);
+                        break;
+                    }
+                }
+            }
+            xSemaphoreGive(commandQueueMutex);
+        }
+    }
+}
+
+int queuedCommandCount() {
+    return commandCount;
+}
@@ -0,0 +1,113 @@
+#include "compact_state.h"
+
+#define COMPACT_FIELD_COUNT 6
+
+static int recordMapping = 0;
+static int recordMember = 0;
+static int fieldIndex = 0;
+static int32_t fields[COMPACT_FIELD_COUNT];
+static int32_t fieldValue = 0;
+static bool fieldNegative = false;
+
+size_t buildStateTemplateMessage(char* buffer, size_t size, unsigned long id) {
+    int written = snprintf(buffer, size,
+        "{\"id\":%lu,\"type\":\"render_template\",\"template\":\""
+        "{%%- for e in [", id);
+
+    char member[MAX_ENTITY_ID_LENGTH];
+    bool first = true;
+    for (int i = 0; i < NUM_MAPPINGS && written > 0 && (size_t)written < size; i++) {
+        for (int m = 0; m < mappingMemberCount(i) && (size_t)written < size; m++) {
+            if (getMappingMember(i, m, member, sizeof(member))) {
+                written += snprintf(buffer + written, size - written, "%s'%s'", first ? "" : ",", member);
+                first = false;
+            }
+        }
+    }
+
+    if (written > 0 && (size_t)written < size) {
+        written += snprintf(buffer + written, size - written,
+            "] -%%}{%%- set s = states[e] -%%}{%%- if s -%%}"
+            "{{ 1 if s.state in ['on','playing'] else 0 }},"
+            "{{ (s.attributes.rgb_color or [-1,-1,-1]) | join(',') }},"
+            "{{ s.attributes.brightness | int(-1) }},"
+            "{{ (s.attributes.volume_level * 255) | int if s.attributes.volume_level is number else -1 }}"
+            "{%%- endif -%%};{%%- endfor -%%}\"}");
+    }
+
+    if (written <= 0 || (size_t)written >= size) {
+        SERIAL_PRINTLN("State template does not fit in SUBSCRIBE_MESSAGE_BUFFER_SIZE");
+        return 0;
+    }
+    return written;
+}
+
+static void resetField() {
+    fieldValue = 0;
+    fieldNegative = false;
+}
+
+void beginCompactState() {
+    recordMapping = 0;
+    recordMember = 0;
+    fieldIndex = 0;
+    resetField();
+}
+
+static void applyCompactRecord(int mappingIndex, int member) {
+    EntityUpdate update = {};
+    update.member = member;
+    update.has_state = true;
+    update.is_on = fields[0] == 1;
+    update.has_attributes = true;
+    if (fields[1] >= 0 && fields[2] >= 0 && fields[3] >= 0) {
+        update.has_rgb = true;
+        update.r = fields[1];
+        update.g = fields[2];
+        update.b = fields[3];
+    }
+    if (fields[4] >= 0) {
+        update.has_brightness = true;
+        update.brightness = fields[4];
+    }
+    if (fields[5] >= 0) {
+        update.has_volume = true;
+        update.volume = fields[5] / 255.0f;
+    }
+    updateLEDState(entityMappings[mappingIndex].page, entityMappings[mappingIndex].x, entityMappings[mappingIndex].y, &update);
+}
+
+static void endRecord() {
+    if (fieldIndex == COMPACT_FIELD_COUNT - 1 && recordMapping < NUM_MAPPINGS) {
+        fields[fieldIndex] = fieldNegative ? -fieldValue : fieldValue;
+        applyCompactRecord(recordMapping, recordMember);
+    }
+    // Anything else is an empty record (entity missing in HA) or malformed, and leaves the LED untouched
+
+    // Records follow the flattened member list of every mapping
+    if (recordMapping < NUM_MAPPINGS && ++recordMember >= mappingMemberCount(recordMapping)) {
+        recordMapping++;
+        recordMember = 0;
+    }
+    fieldIndex = 0;
+    resetField();
+}
+
+void feedCompactState(const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        char c = data[i];
+
+        if (c == ';') {
+            endRecord();
+        } else if (c >= '0' && c <= '9') {
+            fieldValue = fieldValue * 10 + (c - '0');
+        } else if (c == '-') {
+            fieldNegative = true;
+        } else if (c == ',') {
+            if (fieldIndex < COMPACT_FIELD_COUNT - 1) {
+                fields[fieldIndex++] = fieldNegative ? -fieldValue : fieldValue;
+            }
+            resetField();
+        }
+    }
+}
@@ -1,37 +1,118 @@
 #include "entity_state.h"
 
-EntityState entityStates[ROWS][COLS];
-EntityState savedStates[ROWS][COLS];
+static_assert(NUM_PAGES >= 1 && NUM_PAGES <= 255, "NUM_PAGES must be between 1 and 255");
+static_assert(NUM_MAPPINGS <= 127, "pageMappings holds mapping indexes as int8_t");
+
+// Only reached through readEntityState and writeEntityState once the tasks are running
+static EntityState entityStates[NUM_PAGES][ROWS][COLS];
+static std::atomic<uint32_t> entityStateSequence[NUM_PAGES][ROWS][COLS]; // Odd while the key is being written
+int8_t pageMappings[NUM_PAGES][ROWS][COLS];
+volatile uint8_t currentPage = 0;
 
 
 void initializeEntityStates() {
-    for (int y = 0; y < ROWS; y++) {
-        for (int x = 0; x < COLS; x++) {
-            entityStates[y][x] = {false, 255, 255, 255, 255, x, y};
+    for (int page = 0; page < NUM_PAGES; page++) {
+        for (int y = 0; y < ROWS; y++) {
+            for (int x = 0; x < COLS; x++) {
+                entityStates[page][y][x] = {false, 255, 255, 255, 255};
+                pageMappings[page][y][x] = -1;
+            }
         }
     }
     
     // Set registered entities
     for (int i = 0; i < NUM_MAPPINGS; i++) {
-        int x = entityMappings[i].x;
-        int y = entityMappings[i].y;
-        entityStates[y][x].is_on = false;
-        entityStates[y][x].r = entityMappings[i].default_r;
-        entityStates[y][x].g = entityMappings[i].default_g;
-        entityStates[y][x].b = entityMappings[i].default_b;
-        entityStates[y][x].brightness = entityMappings[i].default_brightness;
+        const EntityMapping& mapping = entityMappings[i];
+        if (mapping.page >= NUM_PAGES || mapping.x < 0 || mapping.x >= COLS || mapping.y < 0 || mapping.y >= ROWS) {
+            SERIAL_PRINTF("Ignoring %s: key (%d, %d) on page %d is outside the keypad\n", mapping.entity_id, mapping.x, mapping.y, mapping.page);
+            continue;
+        }
+        EntityState& state = entityStates[mapping.page][mapping.y][mapping.x];
+        state.is_on = false;
+        state.r = mapping.default_r;
+        state.g = mapping.default_g;
+        state.b = mapping.default_b;
+        state.brightness = mapping.default_brightness;
+        if (pageMappings[mapping.page][mapping.y][mapping.x] < 0) {
+            pageMappings[mapping.page][mapping.y][mapping.x] = i;
+        }
+    }
+}
+
+EntityState readEntityState(int page, int x, int y) {
+    const EntityState& slot = entityStates[page][y][x];
+    std::atomic<uint32_t>& sequence = entityStateSequence[page][y][x];
+    EntityState state;
+    while (true) {
+        uint32_t before = sequence.load(std::memory_order_acquire);
+        if (!(before & 1)) {
+            memcpy(&state, &slot, sizeof(state));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) {
+                return state;
+            }
+        }
+        taskYIELD(); // The writer was preempted mid-update; let it finish
     }
 }
 
-void saveCurrentStates() {
-    memcpy(savedStates, entityStates, sizeof(entityStates));
+void writeEntityState(int page, int x, int y, const EntityState& state) {
+    std::atomic<uint32_t>& sequence = entityStateSequence[page][y][x];
+    uint32_t before = sequence.load(std::memory_order_relaxed);
+    sequence.store(before + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&entityStates[page][y][x], &state, sizeof(state));
+    sequence.store(before + 2, std::memory_order_release);
 }
 
-void restoreStates() {
-    memcpy(entityStates, savedStates, sizeof(entityStates));
-    for (int y = 0; y < ROWS; y++) {
-        for (int x = 0; x < COLS; x++) {
-            updateLED(x, y);
+// Mapping of a key on the page currently shown
+int findMappingIndex(int x, int y) {
+    return pageMappings[currentPage][y][x];
+}
+
+// A mapping's entity_id may list several entities separated by commas, e.g. "light.a,light.b"
+int mappingMemberCount(int mappingIndex) {
+    int count = 1;
+    for (const char* c = entityMappings[mappingIndex].entity_id; *c; c++) {
+        if (*c == ',') {
+            count++;
         }
     }
+    return min(count, MAX_GROUP_MEMBERS);
+}
+
+int findMappingMember(int mappingIndex, const char* entity_id) {
+    size_t length = strlen(entity_id);
+    const char* member = entityMappings[mappingIndex].entity_id;
+    for (int i = 0; i < MAX_GROUP_MEMBERS; i++) {
+        const char* end = strchr(member, ',');
+        size_t memberLength = end ? (size_t)(end - member) : strlen(member);
+        if (memberLength == length && strncmp(member, entity_id, length) == 0) {
+            return i;
+        }
+        if (!end) {
+            break;
+        }
+        member = end + 1;
+    }
+    return -1;
+}
+
+bool getMappingMember(int mappingIndex, int member, char* buffer, size_t size) {
+    const char* start = entityMappings[mappingIndex].entity_id;
+    for (int i = 0; i < member; i++) {
+        start = strchr(start, ',');
+        if (!start) {
+            return false;
+        }
+        start++;
+    }
+    const char* end = strchr(start, ',');
+    size_t length = end ? (size_t)(end - start) : strlen(start);
+    if (length >= size) {
+        return false;
+    }
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    return true;
 }
@@ -0,0 +1,76 @@
+#include "event_loop.h"
+#include <esp_vfs_eventfd.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <sys/select.h>
+#include <WiFi.h>
+
+// Other tasks write to this eventfd to wake the loop task out of select()
+static int wakeFd = -1;
+
+void initializeEventLoop() {
+    esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    if (esp_vfs_eventfd_register(&config) == ESP_OK) {
+        wakeFd = eventfd(0, 0);
+    }
+    if (wakeFd < 0) {
+        SERIAL_PRINTLN("Failed to create loop wake event, falling back to timed waits");
+    }
+
+    // The radio dozes between beacons but stays associated, so incoming frames still wake the loop
+    WiFi.setSleep(WIFI_PS_MIN_MODEM);
+
+    if (ENABLE_LIGHT_SLEEP) {
+        esp_pm_config_esp32c3_t pmConfig = {};
+        pmConfig.max_freq_mhz = 160;
+        pmConfig.min_freq_mhz = 40;
+        pmConfig.light_sleep_enable = true;
+        esp_err_t err = esp_pm_configure(&pmConfig);
+        if (err != ESP_OK) {
+            SERIAL_PRINTF("Light sleep unavailable: %s\n", esp_err_to_name(err));
+        }
+        esp_sleep_enable_gpio_wakeup();
+    }
+}
+
+void notifyLoopTask() {
+    if (wakeFd >= 0) {
+        uint64_t one = 1;
+        write(wakeFd, &one, sizeof(one));
+    }
+}
+
+// Blocks until the WebSocket has data, another task calls notifyLoopTask, or the timeout passes
+void waitForLoopEvent(unsigned long timeoutMs) {
+    if (timeoutMs == 0 || webSocket.hasBufferedData()) {
+        return;
+    }
+
+    fd_set readFds;
+    FD_ZERO(&readFds);
+    int maxFd = -1;
+    if (wakeFd >= 0) {
+        FD_SET(wakeFd, &readFds);
+        maxFd = wakeFd;
+    }
+    int socketFd = webSocket.socketFd();
+    if (socketFd >= 0) {
+        FD_SET(socketFd, &readFds);
+        maxFd = max(maxFd, socketFd);
+    } else if (webSocket.isConnected()) {
+        timeoutMs = min(timeoutMs, (unsigned long)LOOP_UNWATCHED_SOCKET_POLL_MS); // Frames can't wake select()
+    }
+
+    if (maxFd < 0) {
+        vTaskDelay(pdMS_TO_TICKS(timeoutMs));
+    } else {
+        struct timeval timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        if (select(maxFd + 1, &readFds, NULL, NULL, &timeout) > 0 && wakeFd >= 0 && FD_ISSET(wakeFd, &readFds)) {
+            uint64_t count;
+            read(wakeFd, &count, sizeof(count));
+        }
+    }
+    profilerRecordLoopWakeup();
+}
@@ -0,0 +1,91 @@
+#include "fade.h"
+
+// Owned by whoever holds xMutex; only the pixel colours leave this file
+static FadePixel fadePixels[NUM_LEDS];
+static int activeFades = 0;
+
+static uint16_t channel(uint32_t color, int shift) {
+    return ((color >> shift) & 0xFF) << 8;
+}
+
+// Progress through a fade as Q16, 65536 = done
+static uint32_t fadeProgress(const FadePixel& pixel, uint32_t now) {
+    uint32_t elapsed = now - pixel.startTime;
+    if (elapsed >= pixel.duration) {
+        return 65536;
+    }
+    uint32_t t = (elapsed << 16) / pixel.duration;
+    if (LED_FADE_EASING == FADE_EASE_IN_OUT) {
+        // smoothstep: t * t * (3 - 2t)
+        t = (uint32_t)(((uint64_t)((t * t) >> 16) * (3 * 65536 - 2 * t)) >> 16);
+    }
+    return t;
+}
+
+static uint16_t interpolate(uint16_t from, uint16_t to, uint32_t progress) {
+    return from + (int32_t)(((int64_t)((int32_t)to - from) * progress) >> 16);
+}
+
+static uint32_t toColor(const uint16_t value[3]) {
+    return ((uint32_t)((value[0] + 0x80) >> 8) << 16) | ((uint32_t)((value[1] + 0x80) >> 8) << 8) | ((value[2] + 0x80) >> 8);
+}
+
+// Starts a fade from what the pixel shows now. A pixel already fading starts again from its
+// current value, so a retarget near the end of a fade still gets the full LED_FADE_MS to get there.
+void fadeSetTarget(int index, uint32_t shownColor, uint32_t targetColor, uint32_t now) {
+    FadePixel& pixel = fadePixels[index];
+
+    if (pixel.active) {
+        uint32_t progress = fadeProgress(pixel, now);
+        for (int c = 0; c < 3; c++) {
+            pixel.from[c] = interpolate(pixel.from[c], pixel.to[c], progress);
+        }
+    } else {
+        pixel.from[0] = channel(shownColor, 16);
+        pixel.from[1] = channel(shownColor, 8);
+        pixel.from[2] = channel(shownColor, 0);
+        pixel.active = true;
+        activeFades++;
+    }
+    pixel.to[0] = channel(targetColor, 16);
+    pixel.to[1] = channel(targetColor, 8);
+    pixel.to[2] = channel(targetColor, 0);
+    pixel.startTime = now;
+    pixel.duration = LED_FADE_MS;
+}
+
+// Leaves every pixel as it is on the strip, for code that is about to draw over it
+void fadeCancelAll() {
+    for (int i = 0; i < NUM_LEDS; i++) {
+        fadePixels[i].active = false;
+    }
+    activeFades = 0;
+}
+
+bool fadeActive() {
+    return activeFades > 0;
+}
+
+// Writes the current colour of every fading pixel; returns true if anything was written
+bool fadeTick(uint32_t now, FadeWriter write) {
+    if (activeFades == 0) {
+        return false;
+    }
+    for (int i = 0; i < NUM_LEDS; i++) {
+        FadePixel& pixel = fadePixels[i];
+        if (!pixel.active) {
+            continue;
+        }
+        uint32_t progress = fadeProgress(pixel, now);
+        uint16_t value[3];
+        for (int c = 0; c < 3; c++) {
+            value[c] = interpolate(pixel.from[c], pixel.to[c], progress);
+        }
+        write(i, toColor(value));
+        if (progress >= 65536) {
+            pixel.active = false;
+            activeFades--;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+#include "gesture.h"
+
+// Plain C++ with no Arduino dependencies, so timelines can be replayed on a host
+
+enum GestureInput : uint8_t {
+    GESTURE_INPUT_PRESS,
+    GESTURE_INPUT_RELEASE,
+    GESTURE_INPUT_LONG_TIMEOUT,
+    GESTURE_INPUT_DOUBLE_TIMEOUT,
+    GESTURE_INPUT_CANCEL,
+    GESTURE_INPUT_COUNT
+};
+
+struct GestureTransition {
+    GestureState next;
+    uint8_t events;
+};
+
+#define T(state, events) {GESTURE_STATE_##state, events}
+
+// Columns: PRESS, RELEASE, LONG_TIMEOUT, DOUBLE_TIMEOUT, CANCEL
+static const GestureTransition gestureTable[GESTURE_STATE_COUNT][GESTURE_INPUT_COUNT] = {
+    // IDLE
+    {T(PRESSED, 0), T(IDLE, 0), T(IDLE, 0), T(IDLE, 0), T(IDLE, 0)},
+    // PRESSED
+    {T(PRESSED, 0), T(WAITING, GESTURE_TAP), T(HELD, GESTURE_HOLD), T(PRESSED, 0), T(SUPPRESSED, 0)},
+    // HELD
+    {T(HELD, 0), T(IDLE, GESTURE_LONG_PRESS), T(HELD, 0), T(HELD, 0), T(SUPPRESSED, 0)},
+    // WAITING
+    {T(SECOND_PRESSED, GESTURE_DOUBLE_TAP), T(WAITING, 0), T(WAITING, 0), T(IDLE, 0), T(IDLE, 0)},
+    // SECOND_PRESSED: a double tap that is then held does nothing more
+    {T(SECOND_PRESSED, 0), T(IDLE, 0), T(SUPPRESSED, 0), T(SECOND_PRESSED, 0), T(SUPPRESSED, 0)},
+    // SUPPRESSED
+    {T(SUPPRESSED, 0), T(IDLE, 0), T(SUPPRESSED, 0), T(SUPPRESSED, 0), T(SUPPRESSED, 0)},
+};
+
+#undef T
+
+static uint8_t applyInput(GestureKey& key, GestureInput input) {
+    const GestureTransition& transition = gestureTable[key.state][input];
+    key.state = transition.next;
+    return transition.events;
+}
+
+void gestureInit(GestureKey& key, bool multiTap) {
+    key.state = GESTURE_STATE_IDLE;
+    key.wasPressed = false;
+    key.multiTap = multiTap;
+    key.pressTime = 0;
+    key.releaseTime = 0;
+}
+
+uint8_t gestureUpdate(GestureKey& key, bool pressed, unsigned long now) {
+    uint8_t events = 0;
+
+    // Timeouts first, so an expired double tap window turns a new press into a fresh tap
+    if ((key.state == GESTURE_STATE_PRESSED || key.state == GESTURE_STATE_SECOND_PRESSED) &&
+        now - key.pressTime >= LONG_PRESS_TIME) {
+        events |= applyInput(key, GESTURE_INPUT_LONG_TIMEOUT);
+    } else if (key.state == GESTURE_STATE_WAITING &&
+               (!key.multiTap || now - key.releaseTime >= DOUBLE_TAP_WINDOW)) {
+        events |= applyInput(key, GESTURE_INPUT_DOUBLE_TIMEOUT);
+    }
+
+    if (pressed != key.wasPressed) {
+        key.wasPressed = pressed;
+        if (pressed) {
+            key.pressTime = now;
+            events |= applyInput(key, GESTURE_INPUT_PRESS);
+        } else {
+            key.releaseTime = now;
+            events |= applyInput(key, GESTURE_INPUT_RELEASE);
+        }
+    }
+
+    return events;
+}
+
+void gestureCancel(GestureKey& key) {
+    applyInput(key, GESTURE_INPUT_CANCEL);
+}
+
+// True when the key has nothing pending, so it can't produce an event until it is pressed again
+bool gestureIdle(const GestureKey& key) {
+    return key.state == GESTURE_STATE_IDLE;
+}
@@ -0,0 +1,92 @@
+#include "heartbeat.h"
+#include "websocket_handler.h"
+#include "led_control.h"
+
+unsigned long heartbeatRttMicros = 0;
+unsigned long heartbeatJitterMicros = 0;
+unsigned long heartbeatReconnects = 0;
+
+// All of this runs on the loop task
+static bool linkUp = false;
+static unsigned long pendingPingId = 0; // 0 when no ping is outstanding
+static unsigned long pingSentMicros = 0;
+static unsigned long lastPingTime = 0;
+static int missedPongs = 0;
+
+void heartbeatStart() {
+    linkUp = true;
+    pendingPingId = 0;
+    missedPongs = 0;
+    lastPingTime = millis();
+    setHealthIndicator(0);
+}
+
+void heartbeatStop() {
+    linkUp = false;
+    pendingPingId = 0;
+}
+
+void heartbeatPong(unsigned long id) {
+    if (id == 0 || id != pendingPingId) {
+        return; // Answer to a ping we already gave up on
+    }
+    long rtt = micros() - pingSentMicros;
+    if (heartbeatRttMicros == 0) {
+        heartbeatRttMicros = rtt;
+        heartbeatJitterMicros = rtt / 2;
+    } else {
+        // Same smoothing as TCP's SRTT and RTTVAR (RFC 6298)
+        long deviation = labs(rtt - (long)heartbeatRttMicros);
+        heartbeatJitterMicros = (3 * heartbeatJitterMicros + deviation) / 4;
+        heartbeatRttMicros = (7 * heartbeatRttMicros + rtt) / 8;
+    }
+    pendingPingId = 0;
+    if (missedPongs > 0) {
+        missedPongs = 0;
+        setHealthIndicator(0);
+    }
+}
+
+static void sendPing() {
+    char message[48];
+    pendingPingId = messageId++;
+    int length = snprintf(message, sizeof(message), "{\"id\":%lu,\"type\":\"ping\"}", pendingPingId);
+    pingSentMicros = micros();
+    lastPingTime = millis();
+    webSocket.sendTXT(message, length);
+}
+
+void heartbeatTick() {
+    if (!linkUp || millis() - lastPingTime < HEARTBEAT_INTERVAL_MS) {
+        return;
+    }
+
+    if (isBrightnessUpdateInProgress) {
+        // Pongs are queued behind the adjustment, so this interval can't tell us anything
+        pendingPingId = 0;
+        lastPingTime = millis();
+        return;
+    }
+
+    if (pendingPingId != 0) {
+        missedPongs++;
+        SERIAL_PRINTF("Missed pong %d of %d\n", missedPongs, HEARTBEAT_MAX_MISSED);
+        setHealthIndicator(COLOR_ORANGE);
+        if (missedPongs >= HEARTBEAT_MAX_MISSED) {
+            SERIAL_PRINTLN("Home Assistant stopped answering, reconnecting");
+            heartbeatReconnects++;
+            heartbeatStop();
+            failOverWebSocket(); // With a single endpoint this reconnects to it
+            return;
+        }
+    }
+    sendPing();
+}
+
+unsigned long heartbeatNextDue() {
+    if (!linkUp) {
+        return ULONG_MAX;
+    }
+    unsigned long elapsed = millis() - lastPingTime;
+    return elapsed >= HEARTBEAT_INTERVAL_MS ? 0 : HEARTBEAT_INTERVAL_MS - elapsed;
+}
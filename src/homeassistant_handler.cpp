@@ -1,5 +1,55 @@
 #include "homeassistant_handler.h"
 
+// Sets target.entity_id to a single id, or to an array when given a comma separated group
+static void addEntityTargets(JsonVariant target, const char* entity_ids) {
+    if (!strchr(entity_ids, ',')) {
+        target["entity_id"] = entity_ids;
+        return;
+    }
+    JsonArray targets = target.createNestedArray("entity_id");
+    char member[MAX_ENTITY_ID_LENGTH];
+    for (const char* start = entity_ids; start; ) {
+        const char* end = strchr(start, ',');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+        if (length < sizeof(member)) {
+            memcpy(member, start, length);
+            member[length] = '\0';
+            targets.add((char*)member); // Non-const so ArduinoJson copies it
+        }
+        start = end ? end + 1 : nullptr;
+    }
+}
+
+// Commands are only formatted on the loop task as they leave the outbound queue, so they
+// share one document and buffer and nothing is allocated per call
+static StaticJsonDocument<SERVICE_CALL_DOC_SIZE> serviceCallDoc;
+static char serviceCallMessage[SERVICE_CALL_MESSAGE_SIZE];
+
+// Levels of the last execute_script until its result arrives. A normal user's token is refused
+// execute_script, in which case they are sent again one call_service each and batching stops.
+static unsigned long levelBatchId = 0;
+static int levelBatchMappings[COMMAND_BATCH_SIZE];
+static int levelBatchValues[COMMAND_BATCH_SIZE];
+static int levelBatchCount = 0;
+static bool levelBatchesRejected = false;
+
+static const char AUTH_MESSAGE[] = "{\"type\": \"auth\", \"access_token\": \"" HA_API_PASSWORD "\"}";
+
+// Returns false only when the socket refused the message; one that can never be sent counts as done
+static bool sendServiceCall() {
+    size_t length = serializeJson(serviceCallDoc, serviceCallMessage, sizeof(serviceCallMessage));
+    if (length == 0 || length >= sizeof(serviceCallMessage) - 1) {
+        SERIAL_PRINTLN("Service call does not fit in SERVICE_CALL_MESSAGE_SIZE");
+        return true;
+    }
+    SERIAL_PRINTF("Sending message: %s\n", serviceCallMessage);
+    return webSocket.sendTXT(serviceCallMessage, length);
+}
+
+// A message may arrive in several fragments; these add up its size and parse time for the profiler
+static size_t messageBytes = 0;
+static unsigned long messageHandleMicros = 0;
+
 void handleHomeAssistantMessage(uint8_t* payload, size_t length) {
     SERIAL_PRINTLN("Entering handleHomeAssistantMessage");
     if (isBrightnessUpdateInProgress) {
@@ -10,190 +60,308 @@ void handleHomeAssistantMessage(uint8_t* payload, size_t length) {
     SERIAL_PRINT("Message content: ");
     SERIAL_PRINTLN((char*)payload);
 
-    DynamicJsonDocument doc(JSON_BUFFER_SIZE);
-    DeserializationError error = deserializeJson(doc, payload, DeserializationOption::NestingLimit(10));
-    
-    if (error) {
-        SERIAL_PRINTF("deserializeJson() failed: %s\n", error.c_str());
-        SERIAL_PRINTF("Payload: %.*s\n", length, payload);
+    beginHomeAssistantMessage();
+    feedHomeAssistantMessage(payload, length);
+    finishHomeAssistantMessage();
+    SERIAL_PRINTLN("Exiting handleHomeAssistantMessage");
+}
+
+void beginHomeAssistantMessage() {
+    messageBytes = 0;
+    messageHandleMicros = 0;
+    beginStateStream();
+}
+
+void feedHomeAssistantMessage(const uint8_t* data, size_t length) {
+    unsigned long parseStartTime = micros();
+    feedStateStream(data, length);
+    messageBytes += length;
+    messageHandleMicros += micros() - parseStartTime;
+}
+
+void finishHomeAssistantMessage() {
+    metricsRecordParse(messageHandleMicros);
+    if (!finishStateStream()) {
+        SERIAL_PRINTF("Malformed message after %d bytes\n", messageBytes);
         return;
     }
 
-    if (doc["type"] == "auth_ok") {
+    const char* type = stateStreamMessageType();
+    if (strcmp(type, "auth_ok") == 0) {
         SERIAL_PRINTLN("Authentication successful");
-        subscribeToEntities();
-    } else if (doc["type"] == "event") {
-        SERIAL_PRINTLN("Received event type message");
-        JsonObject event = doc["event"];
-        if (event.containsKey("a")) {
-            JsonObject entities = event["a"];
-            for (JsonPair entity : entities) {
-                const char* entity_id = entity.key().c_str();
-                if (strcmp(entity_id, "sensor.time") == 0) {
-                    updateTimeAndCheckNightMode(entity.value()["s"]);
-                } else {
-                    for (int i = 0; i < NUM_MAPPINGS; i++) {
-                        if (strcmp(entity_id, entityMappings[i].entity_id) == 0) {
-                            updateLED(entityMappings[i].x, entityMappings[i].y, entity.value().as<JsonObject>());
-                            break;
-                        }
-                    }
-                }
-            }
-        } else if (event.containsKey("c")) {
-            JsonObject changes = event["c"];
-            for (JsonPair change : changes) {
-                const char* entity_id = change.key().c_str();
-                JsonObject state = change.value();
-                if (strcmp(entity_id, "sensor.time") == 0) {
-                    if (state.containsKey("+") && state["+"].containsKey("s")) {
-                        updateTimeAndCheckNightMode(state["+"]["s"]);
-                    }
-                } else {
-                    if (state.containsKey("+")) {
-                        state = state["+"];
-                    }
-                    for (int i = 0; i < NUM_MAPPINGS; i++) {
-                        if (strcmp(entity_id, entityMappings[i].entity_id) == 0) {
-                            updateLED(entityMappings[i].x, entityMappings[i].y, state);
-                            break;
-                        }
-                    }
-                }
-            }
+        bootMark(BOOT_AUTHENTICATED);
+        setCommandLinkState(COMMAND_LINK_AUTHENTICATED);
+        webSocketAuthenticated();
+        levelBatchCount = 0; // Its result went with the old connection
+        subscribeToEntities(); // Control priority, so it goes out ahead of presses buffered while offline
+        heartbeatStart();
+    } else if (strcmp(type, "result") == 0 && levelBatchCount > 0 && stateStreamMessageId() == levelBatchId) {
+        if (!stateStreamMessageSucceeded()) {
+            SERIAL_PRINTLN("execute_script was refused (it needs an admin token), sending levels one by one");
+            levelBatchesRejected = true;
+            requeueLevels(levelBatchMappings, levelBatchValues, levelBatchCount);
         }
+        levelBatchCount = 0;
+    } else if (strcmp(type, "pong") == 0) {
+        heartbeatPong(stateStreamMessageId());
+    } else if (strcmp(type, "event") == 0) {
+        bootMark(BOOT_STATE_RESTORED); // The first event after subscribing carries every entity's state
+        profilerRecordStateMessage(messageBytes, messageHandleMicros);
     }
-    SERIAL_PRINTLN("Exiting handleHomeAssistantMessage");
 }
 
 
-void updateTimeAndCheckNightMode(const char* time_str) {
-    SERIAL_PRINTF("Received time update: %s\n", time_str);
-
-    if (!time_str || strlen(time_str) < 5) {
-        SERIAL_PRINTLN("Invalid time string received");
+void toggleEntity(int x, int y) {
+    int index = findMappingIndex(x, y);
+    if (index < 0) {
+        SERIAL_PRINTF("No entity found at (%d, %d) to toggle\n", x, y);
         return;
     }
+    // A group is switched from the state the key showed when it was pressed, even if the
+    // command only goes out after a reconnect
+    queueCommand(COMMAND_TOGGLE, index, readKeyState(x, y).is_on);
+}
 
-    int hour = 0, minute = 0;
-    if (sscanf(time_str, "%d:%d", &hour, &minute) != 2) {
-        SERIAL_PRINTF("Failed to parse time string: %s\n", time_str);
-        return;
+static bool buildToggle(const OutboundCommand& command) {
+    const EntityMapping& mapping = entityMappings[command.mapping];
+    StaticJsonDocument<SERVICE_CALL_DOC_SIZE>& doc = serviceCallDoc;
+    doc.clear();
+    doc["id"] = messageId++;
+    doc["type"] = "call_service";
+
+    if (mappingMemberCount(command.mapping) > 1) {
+        // Toggling members individually would let them drift apart, so drive the whole group
+        // from the aggregate state in a single call
+        bool anyOn = command.value != 0;
+        if (isMediaPlayer(mapping.entity_id)) {
+            doc["domain"] = "media_player";
+            doc["service"] = anyOn ? "media_pause" : "media_play";
+        } else {
+            doc["domain"] = "homeassistant";
+            doc["service"] = anyOn ? "turn_off" : "turn_on";
+        }
+        SERIAL_PRINTF("Attempting to switch group %s: %s\n", anyOn ? "off" : "on", mapping.entity_id);
+    } else if (isMediaPlayer(mapping.entity_id)) {
+        doc["domain"] = "media_player";
+        doc["service"] = "media_play_pause";
+        SERIAL_PRINTF("Attempting to play/pause media player: %s\n", mapping.entity_id);
+    } else if (isLight(mapping.entity_id)) {
+        doc["domain"] = "light";
+        doc["service"] = "toggle";
+        SERIAL_PRINTF("Attempting to toggle light: %s\n", mapping.entity_id);
+    } else if (isSwitch(mapping.entity_id)) {
+        doc["domain"] = "homeassistant";
+        doc["service"] = "toggle";
+        SERIAL_PRINTF("Attempting to toggle switch: %s\n", mapping.entity_id);
+    } else if (isScene(mapping.entity_id)) {
+        doc["domain"] = "scene";
+        doc["service"] = "turn_on";
+        SERIAL_PRINTF("Attempting to activate scene: %s\n", mapping.entity_id);
+    } else {
+        SERIAL_PRINTF("Unknown entity type: %s\n", mapping.entity_id);
+        return false;
     }
 
-    if (hour < 0 || hour > 23 || minute < 0 || minute > 59) {
-        SERIAL_PRINTF("Invalid time values: %02d:%02d\n", hour, minute);
+    addEntityTargets(doc["target"], mapping.entity_id);
+    return true;
+}
+
+void performGestureAction(int x, int y, GestureAction action) {
+    int index = findMappingIndex(x, y);
+    if (index < 0) {
+        SERIAL_PRINTF("No entity found at (%d, %d) for gesture action\n", x, y);
         return;
     }
 
-    bool newIsNightMode;
-    if (NIGHT_START_HOUR > NIGHT_END_HOUR) {
-        // Night mode spans midnight
-        newIsNightMode = (hour >= NIGHT_START_HOUR || hour < NIGHT_END_HOUR);
-    } else {
-        // Night mode doesn't span midnight
-        newIsNightMode = (hour >= NIGHT_START_HOUR && hour < NIGHT_END_HOUR);
-    }
-    if (newIsNightMode != isNightMode) {
-        isNightMode = newIsNightMode;
-        SERIAL_PRINTF("Night mode changed to: %s (Time: %02d:%02d)\n", isNightMode ? "ON" : "OFF", hour, minute);
-        for (int y = 0; y < ROWS; y++) {
-            for (int x = 0; x < COLS; x++) {
-                updateLED(x, y);
-            }
+    if (action == GESTURE_ACTION_TOGGLE) {
+        toggleEntity(x, y);
+    } else if (action == GESTURE_ACTION_FULL_BRIGHTNESS) {
+        if (isLight(entityMappings[index].entity_id)) {
+            sendBrightnessOrVolumeUpdate(index, 255);
         }
     } else {
-        SERIAL_PRINTF("Night mode unchanged: %s (Time: %02d:%02d)\n", isNightMode ? "ON" : "OFF", hour, minute);
+        queueCommand(COMMAND_GESTURE, index, 0, action);
     }
 }
 
+static bool buildGestureAction(const OutboundCommand& command) {
+    const char* entity_id = entityMappings[command.mapping].entity_id;
+    StaticJsonDocument<SERVICE_CALL_DOC_SIZE>& doc = serviceCallDoc;
+    doc.clear();
+    doc["id"] = messageId++;
+    doc["type"] = "call_service";
 
-
-void toggleEntity(int x, int y) {
-    for (int i = 0; i < NUM_MAPPINGS; i++) {
-        if (entityMappings[i].x == x && entityMappings[i].y == y) {
-            DynamicJsonDocument doc(1024);
-            doc["id"] = messageId++;
-            doc["type"] = "call_service";
-            
-            if (isMediaPlayer(entityMappings[i].entity_id)) {
-                doc["domain"] = "media_player";
-                doc["service"] = "media_play_pause";
-                SERIAL_PRINTF("Attempting to play/pause media player: %s\n", entityMappings[i].entity_id);
-            } else if (isLight(entityMappings[i].entity_id)) {
-                doc["domain"] = "light";
-                doc["service"] = "toggle";
-                SERIAL_PRINTF("Attempting to toggle light: %s\n", entityMappings[i].entity_id);
-            } else if (isSwitch(entityMappings[i].entity_id)) {
-                doc["domain"] = "homeassistant";
-                doc["service"] = "toggle";
-                SERIAL_PRINTF("Attempting to toggle switch: %s\n", entityMappings[i].entity_id);
-            } else {
-                SERIAL_PRINTF("Unknown entity type: %s\n", entityMappings[i].entity_id);
-                return;
-            }
-            
-            doc["target"]["entity_id"] = entityMappings[i].entity_id;
-
-            String message;
-            serializeJson(doc, message);
-            SERIAL_PRINTF("Sending message: %s\n", message.c_str());
-
-            bool sent = webSocket.sendTXT(message);
-            if (sent) {
-                SERIAL_PRINTF("Message sent successfully for entity at (%d, %d): %s\n", x, y, entityMappings[i].entity_id);
-            } else {
-                SERIAL_PRINTF("Failed to send message for entity at (%d, %d): %s\n", x, y, entityMappings[i].entity_id);
-            }
-
-            return;
-        }
+    if (command.action == GESTURE_ACTION_TURN_ON) {
+        doc["domain"] = "homeassistant";
+        doc["service"] = "turn_on";
+    } else if (command.action == GESTURE_ACTION_TURN_OFF) {
+        doc["domain"] = "homeassistant";
+        doc["service"] = "turn_off";
+    } else if (command.action == GESTURE_ACTION_NEXT_TRACK && isMediaPlayer(entity_id)) {
+        doc["domain"] = "media_player";
+        doc["service"] = "media_next_track";
+    } else {
+        SERIAL_PRINTF("Gesture action %d not supported for %s\n", command.action, entity_id);
+        return false;
     }
-    SERIAL_PRINTF("No entity found at (%d, %d) to toggle\n", x, y);
+    addEntityTargets(doc["target"], entity_id);
+    return true;
 }
 
+// Replaces any level for the same key that is still waiting to be sent
+void sendBrightnessOrVolumeUpdate(int mapping, int value) {
+    queueCommand(COMMAND_LEVEL, mapping, value);
+}
 
+// Levels set together are queued together, so they leave in the same message
+void sendBrightnessOrVolumeUpdates(const int* mappings, const int* values, int count) {
+    queueLevels(mappings, values, count);
+}
 
-
-
-void sendBrightnessOrVolumeUpdate(const char* entity_id, int value, bool is_media_player) {
-    DynamicJsonDocument doc(1024);
+static void buildLevelUpdate(const OutboundCommand& command) {
+    const char* entity_id = entityMappings[command.mapping].entity_id;
+    StaticJsonDocument<SERVICE_CALL_DOC_SIZE>& doc = serviceCallDoc;
+    doc.clear();
     doc["id"] = messageId++;
     doc["type"] = "call_service";
-    
-    if (is_media_player) {
+
+    if (isMediaPlayer(entity_id)) {
         doc["domain"] = "media_player";
         doc["service"] = "volume_set";
-        doc["target"]["entity_id"] = entity_id;
-        doc["service_data"]["volume_level"] = value / 255.0f;
-        SERIAL_PRINTF("Adjusting volume for %s to %.2f\n", entity_id, value / 255.0f);
+        addEntityTargets(doc["target"], entity_id);
+        doc["service_data"]["volume_level"] = command.value / 255.0f;
+        SERIAL_PRINTF("Adjusting volume for %s to %.2f\n", entity_id, command.value / 255.0f);
     } else {
         doc["domain"] = "light";
         doc["service"] = "turn_on";
-        doc["target"]["entity_id"] = entity_id;
-        doc["service_data"]["brightness"] = value;
-        SERIAL_PRINTF("Adjusting brightness for %s to %d\n", entity_id, value);
+        addEntityTargets(doc["target"], entity_id);
+        doc["service_data"]["brightness"] = command.value;
+        SERIAL_PRINTF("Adjusting brightness for %s to %d\n", entity_id, command.value);
     }
-
-    String message;
-    serializeJson(doc, message);
-    webSocket.sendTXT(message);
 }
 
 
 void subscribeToEntities() {
-    DynamicJsonDocument doc(1024);
-    doc["id"] = messageId++;
-    doc["type"] = "subscribe_entities";
-    JsonArray entity_ids = doc.createNestedArray("entity_ids");
-    
-    for (int i = 0; i < NUM_MAPPINGS; i++) {
-        entity_ids.add(entityMappings[i].entity_id);
-    }
-    
-    entity_ids.add("sensor.time");
-    
-    String message;
-    serializeJson(doc, message);
-    webSocket.sendTXT(message);
+    queueCommand(COMMAND_SUBSCRIBE);
+}
+
+static bool sendSubscription() {
+    static char message[SUBSCRIBE_MESSAGE_BUFFER_SIZE];
+    size_t messageLength;
+
+    if (USE_TEMPLATE_SUBSCRIPTION) {
+        messageLength = buildStateTemplateMessage(message, sizeof(message), messageId++);
+    } else {
+        messageLength = buildSubscribeEntitiesMessage(message, sizeof(message), messageId++);
+    }
+
+    if (messageLength == 0) {
+        return true;
+    }
+    return webSocket.sendTXT(message, messageLength);
+}
+
+static bool sendCommand(const OutboundCommand& command) {
+    switch (command.kind) {
+        case COMMAND_AUTH:
+            return webSocket.sendTXT(AUTH_MESSAGE);
+        case COMMAND_SUBSCRIBE:
+            return sendSubscription();
+        case COMMAND_TOGGLE:
+            if (!buildToggle(command)) {
+                return true;
+            }
+            break;
+        case COMMAND_GESTURE:
+            if (!buildGestureAction(command)) {
+                return true;
+            }
+            break;
+        case COMMAND_LEVEL:
+            buildLevelUpdate(command);
+            break;
+    }
+    return sendServiceCall();
+}
+
+static bool sendLevelsOneByOne(const OutboundCommand* commands, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!sendCommand(commands[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Commits several levels with one execute_script message, so Home Assistant applies them together
+static bool sendLevelBatch(const OutboundCommand* commands, int count) {
+    if (levelBatchesRejected || levelBatchCount > 0) {
+        // Only one script awaits its result at a time, so a refused one can always be sent again
+        return sendLevelsOneByOne(commands, count);
+    }
+
+    StaticJsonDocument<SERVICE_CALL_DOC_SIZE>& doc = serviceCallDoc;
+    doc.clear();
+    unsigned long id = messageId++;
+    doc["id"] = id;
+    doc["type"] = "execute_script";
+    JsonArray sequence = doc.createNestedArray("sequence");
+    for (int i = 0; i < count; i++) {
+        const char* entity_id = entityMappings[commands[i].mapping].entity_id;
+        JsonObject step = sequence.createNestedObject();
+        if (isMediaPlayer(entity_id)) {
+            step["service"] = "media_player.volume_set";
+            step["data"]["volume_level"] = commands[i].value / 255.0f;
+        } else {
+            step["service"] = "light.turn_on";
+            step["data"]["brightness"] = commands[i].value;
+        }
+        addEntityTargets(step["target"], entity_id);
+    }
+
+    if (doc.overflowed() || measureJson(doc) >= sizeof(serviceCallMessage) - 1) {
+        // Large groups can make the script too long for one message
+        return sendLevelsOneByOne(commands, count);
+    }
+    SERIAL_PRINTF("Committing %d levels in one script\n", count);
+    if (!sendServiceCall()) {
+        return false;
+    }
+    levelBatchId = id;
+    for (int i = 0; i < count; i++) {
+        levelBatchMappings[i] = commands[i].mapping;
+        levelBatchValues[i] = commands[i].value;
+    }
+    levelBatchCount = count;
+    return true;
+}
+
+// Called by the loop task after the socket has been serviced
+void sendQueuedCommands() {
+    serviceCommandQueue(sendCommand, BATCH_LEVEL_UPDATES ? sendLevelBatch : nullptr);
+}
+
+size_t buildSubscribeEntitiesMessage(char* buffer, size_t size, unsigned long id) {
+    int written = snprintf(buffer, size, "{\"id\":%lu,\"type\":\"subscribe_entities\",\"entity_ids\":[", id);
+
+    char member[MAX_ENTITY_ID_LENGTH];
+    bool first = true;
+    for (int i = 0; i < NUM_MAPPINGS && written > 0 && (size_t)written < size; i++) {
+        for (int m = 0; m < mappingMemberCount(i) && (size_t)written < size; m++) {
+            if (getMappingMember(i, m, member, sizeof(member))) {
+                written += snprintf(buffer + written, size - written, "%s\"%s\"", first ? "" : ",", member);
+                first = false;
+            }
+        }
+    }
+
+    if (written > 0 && (size_t)written < size) {
+        written += snprintf(buffer + written, size - written, "]}");
+    }
+
+    if (written <= 0 || (size_t)written >= size) {
+        SERIAL_PRINTLN("Subscription does not fit in SUBSCRIBE_MESSAGE_BUFFER_SIZE");
+        return 0;
+    }
+    return written;
 }
@@ -0,0 +1,239 @@
+#include "json_stream.h"
+#include <string.h>
+
+enum JsonStreamState : uint8_t {
+    JSON_STATE_VALUE,   // Between tokens
+    JSON_STATE_STRING,
+    JSON_STATE_ESCAPE,
+    JSON_STATE_UNICODE,
+    JSON_STATE_NUMBER,
+    JSON_STATE_LITERAL
+};
+
+void jsonStreamInit(JsonStream& stream, JsonStreamHandler handler) {
+    memset(&stream, 0, sizeof(stream));
+    stream.handler = handler;
+    stream.state = JSON_STATE_VALUE;
+}
+
+static void emit(JsonStream& stream, JsonStreamToken token) {
+    stream.token[stream.tokenLength] = '\0';
+    stream.handler(token, stream.token, stream.tokenLength, stream.depth);
+    stream.tokenLength = 0;
+}
+
+static void appendStringChar(JsonStream& stream, char c) {
+    if (stream.tokenLength == JSON_STREAM_TOKEN_SIZE - 1) {
+        if (stream.expectKey) {
+            stream.keyOverflow = true;
+            return;
+        }
+        emit(stream, JSON_STRING_PART);
+    }
+    stream.token[stream.tokenLength++] = c;
+}
+
+static void appendUnicode(JsonStream& stream, uint16_t value) {
+    // Surrogate pairs are encoded one half at a time; entity ids and states never contain them
+    if (value < 0x80) {
+        appendStringChar(stream, value);
+    } else if (value < 0x800) {
+        appendStringChar(stream, 0xC0 | (value >> 6));
+        appendStringChar(stream, 0x80 | (value & 0x3F));
+    } else {
+        appendStringChar(stream, 0xE0 | (value >> 12));
+        appendStringChar(stream, 0x80 | ((value >> 6) & 0x3F));
+        appendStringChar(stream, 0x80 | (value & 0x3F));
+    }
+}
+
+static bool insideObject(const JsonStream& stream) {
+    return stream.depth > 0 && (stream.objectLevels & (1UL << (stream.depth - 1)));
+}
+
+static void endString(JsonStream& stream) {
+    if (stream.expectKey) {
+        if (stream.keyOverflow) {
+            stream.tokenLength = 0;
+        }
+        emit(stream, JSON_KEY);
+        stream.expectKey = false;
+        stream.separator = ':';
+    } else {
+        emit(stream, JSON_STRING);
+        stream.separator = ',';
+    }
+    stream.state = JSON_STATE_VALUE;
+}
+
+static bool endScalar(JsonStream& stream) {
+    stream.token[stream.tokenLength] = '\0';
+    if (stream.state == JSON_STATE_NUMBER) {
+        emit(stream, JSON_NUMBER);
+    } else if (strcmp(stream.token, "true") == 0) {
+        emit(stream, JSON_TRUE);
+    } else if (strcmp(stream.token, "false") == 0) {
+        emit(stream, JSON_FALSE);
+    } else if (strcmp(stream.token, "null") == 0) {
+        emit(stream, JSON_NULL);
+    } else {
+        return false;
+    }
+    stream.state = JSON_STATE_VALUE;
+    stream.separator = ',';
+    return true;
+}
+
+static bool openContainer(JsonStream& stream, bool isObject) {
+    if (stream.depth == JSON_STREAM_MAX_DEPTH || stream.separator != '\0') {
+        return false;
+    }
+    emit(stream, isObject ? JSON_OBJECT_START : JSON_ARRAY_START);
+    if (isObject) {
+        stream.objectLevels |= 1UL << stream.depth;
+    } else {
+        stream.objectLevels &= ~(1UL << stream.depth);
+    }
+    stream.depth++;
+    stream.expectKey = isObject;
+    return true;
+}
+
+static bool closeContainer(JsonStream& stream, bool isObject) {
+    if (stream.depth == 0 || insideObject(stream) != isObject || stream.separator == ':') {
+        return false;
+    }
+    stream.depth--;
+    stream.expectKey = false;
+    stream.separator = ',';
+    emit(stream, isObject ? JSON_OBJECT_END : JSON_ARRAY_END);
+    return true;
+}
+
+static bool feedValueChar(JsonStream& stream, char c) {
+    switch (c) {
+        case ' ': case '\t': case '\r': case '\n':
+            return true;
+        case '{':
+            return openContainer(stream, true);
+        case '[':
+            return openContainer(stream, false);
+        case '}':
+            return closeContainer(stream, true);
+        case ']':
+            return closeContainer(stream, false);
+        case ':':
+        case ',':
+            if (stream.separator != c) {
+                return false;
+            }
+            stream.separator = '\0';
+            stream.expectKey = c == ',' && insideObject(stream);
+            return true;
+    }
+    if (stream.separator != '\0') {
+        return false;
+    }
+    switch (c) {
+        case '"':
+            stream.state = JSON_STATE_STRING;
+            stream.keyOverflow = false;
+            return true;
+    }
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        stream.state = JSON_STATE_NUMBER;
+    } else if (c >= 'a' && c <= 'z') {
+        stream.state = JSON_STATE_LITERAL;
+    } else {
+        return false;
+    }
+    stream.token[stream.tokenLength++] = c;
+    return true;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool feedChar(JsonStream& stream, char c) {
+    switch (stream.state) {
+        case JSON_STATE_STRING:
+            if (c == '"') {
+                endString(stream);
+            } else if (c == '\\') {
+                stream.state = JSON_STATE_ESCAPE;
+            } else {
+                appendStringChar(stream, c);
+            }
+            return true;
+
+        case JSON_STATE_ESCAPE:
+            stream.state = JSON_STATE_STRING;
+            switch (c) {
+                case '"': case '\\': case '/': appendStringChar(stream, c); return true;
+                case 'b': appendStringChar(stream, '\b'); return true;
+                case 'f': appendStringChar(stream, '\f'); return true;
+                case 'n': appendStringChar(stream, '\n'); return true;
+                case 'r': appendStringChar(stream, '\r'); return true;
+                case 't': appendStringChar(stream, '\t'); return true;
+                case 'u':
+                    stream.state = JSON_STATE_UNICODE;
+                    stream.unicodeDigits = 0;
+                    stream.unicodeValue = 0;
+                    return true;
+            }
+            return false;
+
+        case JSON_STATE_UNICODE: {
+            int digit = hexValue(c);
+            if (digit < 0) {
+                return false;
+            }
+            stream.unicodeValue = (stream.unicodeValue << 4) | digit;
+            if (++stream.unicodeDigits == 4) {
+                appendUnicode(stream, stream.unicodeValue);
+                stream.state = JSON_STATE_STRING;
+            }
+            return true;
+        }
+
+        case JSON_STATE_NUMBER:
+        case JSON_STATE_LITERAL: {
+            bool continues = stream.state == JSON_STATE_NUMBER
+                ? (c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-'
+                : (c >= 'a' && c <= 'z');
+            if (continues) {
+                if (stream.tokenLength == JSON_STREAM_TOKEN_SIZE - 1) {
+                    return false;
+                }
+                stream.token[stream.tokenLength++] = c;
+                return true;
+            }
+            if (!endScalar(stream)) {
+                return false;
+            }
+            return feedValueChar(stream, c);
+        }
+    }
+    return feedValueChar(stream, c);
+}
+
+bool jsonStreamFeed(JsonStream& stream, const char* data, size_t length) {
+    for (size_t i = 0; i < length && !stream.failed; i++) {
+        if (!feedChar(stream, data[i])) {
+            stream.failed = true;
+        }
+    }
+    return !stream.failed;
+}
+
+// Completes a trailing top-level number or literal, and reports whether a whole document was read
+bool jsonStreamFinish(JsonStream& stream) {
+    if (!stream.failed && (stream.state == JSON_STATE_NUMBER || stream.state == JSON_STATE_LITERAL)) {
+        stream.failed = !endScalar(stream);
+    }
+    return !stream.failed && stream.depth == 0 && stream.state == JSON_STATE_VALUE;
+}
@@ -1,91 +1,196 @@
 #include "led_control.h"
+#include "event_loop.h"
+#include "animations.h"
 
-Adafruit_NeoPixel strip(NUM_LEDS, LED_PIN, NEO_GRB + NEO_KHZ800);
+#if USE_RMT_LED_DRIVER
+LedStrip strip(NUM_LEDS, LED_PIN);
+#else
+LedStrip strip(NUM_LEDS, LED_PIN, NEO_GRB + NEO_KHZ800);
+#endif
+
+static_assert(HEALTH_LED_X < 0 || !((HEALTH_LED_X == UP_BUTTON_X && HEALTH_LED_Y == UP_BUTTON_Y) ||
+                                    (HEALTH_LED_X == DOWN_BUTTON_X && HEALTH_LED_Y == DOWN_BUTTON_Y)),
+              "HEALTH_LED would be drawn over the up or down button, pick a free key in config.h");
+
+// Shown on the HEALTH_LED key while the connection looks unhealthy, 0 when it is fine
+static uint32_t healthIndicatorColor = 0;
 
 int getLedIndex(int x, int y) {
     return y * COLS + x;
 }
 
 
-void updateLED(int x, int y, const JsonObject& state) {
-    SERIAL_PRINTF("Updating LED at (%d, %d)\n", x, y);
-    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
-        EntityState& currentState = entityStates[y][x];
+static uint32_t keyColor(const EntityState& state, int x, int y) {
+    float scaleFactor = brightnessScale / 255.0f;
+    if (healthIndicatorColor != 0 && x == HEALTH_LED_X && y == HEALTH_LED_Y) {
+        return strip.Color(
+            ((healthIndicatorColor >> 16) & 0xFF) * scaleFactor,
+            ((healthIndicatorColor >> 8) & 0xFF) * scaleFactor,
+            (healthIndicatorColor & 0xFF) * scaleFactor
+        );
+    }
+    if (!state.is_on) {
+        return strip.Color(0, 0, 0);
+    }
+    return strip.Color(
+        map(state.r, 0, 255, 0, state.brightness * scaleFactor),
+        map(state.g, 0, 255, 0, state.brightness * scaleFactor),
+        map(state.b, 0, 255, 0, state.brightness * scaleFactor)
+    );
+}
 
-        if (!state.isNull()) {
-            if (state.containsKey("s")) {
-                currentState.is_on = (state["s"] == "on" || state["s"] == "playing");
-            }
+static bool sameEntityState(const EntityState& a, const EntityState& b) {
+    return a.is_on == b.is_on && a.r == b.r && a.g == b.g && a.b == b.b &&
+           a.brightness == b.brightness && a.volume == b.volume && a.members_on == b.members_on;
+}
+
+// Re-renders a key of the shown page from its current state
+void updateLED(int x, int y) {
+    updateLEDState(currentPage, x, y, nullptr);
+}
 
-            JsonObject attributes = state["a"];
-            if (attributes.isNull()) {
-                // If attributes are null, this might be a switch or media player. Update only the on/off state.
-                currentState.brightness = currentState.is_on ? 255 : 0;
+// Applies an update to a key's cached state; keys on pages that aren't shown are only cached.
+// The state is published before xMutex is taken, so only drawing waits for the strip.
+void updateLEDState(int page, int x, int y, const EntityUpdate* update) {
+    LOG_EVENT(LOG_LEVEL_DEBUG, LOG_LED_UPDATE, x, y);
+    if (update) {
+        EntityState previous = readEntityState(page, x, y);
+        EntityState state = previous;
+        uint32_t memberBit = 1UL << update->member;
+        if (update->has_state) {
+            if (update->is_on) {
+                state.members_on |= memberBit;
             } else {
-                if (currentState.is_on) {
-                    if (attributes.containsKey("rgb_color")) {
-                        JsonArray rgb = attributes["rgb_color"];
-                        currentState.r = rgb[0];
-                        currentState.g = rgb[1];
-                        currentState.b = rgb[2];
-                    }
-                    if (attributes.containsKey("brightness")) {
-                        currentState.brightness = attributes["brightness"];
-                    } else if (attributes.containsKey("volume_level")) {
-                        currentState.volume = attributes["volume_level"];
-                        currentState.brightness = currentState.volume * 255;
-                    } else {
-                        currentState.brightness = 255; // Default to full brightness if not specified
-                    }
-                } else {
-                    currentState.brightness = 0;
-                }
+                state.members_on &= ~memberBit;
             }
+            state.is_on = state.members_on != 0;
         }
 
-        float scaleFactor = isNightMode ? NIGHT_BRIGHTNESS_SCALE : 1.0f;
-        
-        uint32_t color;
-        if (currentState.is_on) {
-            color = strip.Color(
-                map(currentState.r, 0, 255, 0, currentState.brightness * scaleFactor),
-                map(currentState.g, 0, 255, 0, currentState.brightness * scaleFactor),
-                map(currentState.b, 0, 255, 0, currentState.brightness * scaleFactor)
-            );
+        if (!update->has_attributes) {
+            // If attributes are null, this might be a switch or media player. Update only the on/off state.
+            state.brightness = state.is_on ? 255 : 0;
+        } else if (state.is_on && !(state.members_on & memberBit)) {
+            // Another member of a group keeps the key lit; an off member's attributes don't change it
         } else {
-            color = strip.Color(0, 0, 0);
+            if (state.is_on) {
+                if (update->has_rgb) {
+                    state.r = update->r;
+                    state.g = update->g;
+                    state.b = update->b;
+                }
+                if (update->has_brightness) {
+                    state.brightness = update->brightness;
+                } else if (update->has_volume) {
+                    state.volume = update->volume;
+                    state.brightness = state.volume * 255;
+                } else {
+                    state.brightness = 255; // Default to full brightness if not specified
+                }
+            } else {
+                state.brightness = 0;
+            }
         }
+        if (sameEntityState(state, previous)) {
+            // Snapshots after a reconnect or failover repeat most states; the key already shows them
+            return;
+        }
+        writeEntityState(page, x, y, state);
+    }
+
+    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
+        // Read under the lock, so whoever draws last draws the newest state
+        EntityState currentState = readEntityState(page, x, y);
+        uint32_t color = keyColor(currentState, x, y);
+        float scaleFactor = brightnessScale / 255.0f;
 
         int ledIndex = getLedIndex(x, y);
-        strip.setPixelColor(ledIndex, color);
-        strip.show();
+        // Under an overlay the key is redrawn from its state when it ends, and on another page when that page is shown
+        bool visible = page == currentPage && !overlayActive();
+        bool fading = visible && LED_FADE_MS > 0;
+        if (fading) {
+            fadeSetTarget(ledIndex, strip.getPixelColor(ledIndex), color, millis());
+        } else if (visible) {
+            strip.setPixelColor(ledIndex, color);
+            strip.show();
+        }
 
         xSemaphoreGive(xMutex);
 
-        SERIAL_PRINTF("Updated LED at (%d, %d): R=%d, G=%d, B=%d, Brightness=%d, Scaled Brightness=%d, Is On=%d\n",
-                      x, y, currentState.r, currentState.g, currentState.b, currentState.brightness,
-                      (int)(currentState.brightness * scaleFactor), currentState.is_on);
+        if (fading) {
+            notifyLoopTask(); // The loop task renders the fade
+        }
+
+        LOG_EVENT(LOG_LEVEL_DEBUG, LOG_LED_UPDATED, x, y, strip.Color(currentState.r, currentState.g, currentState.b),
+                  currentState.brightness, (int)(currentState.brightness * scaleFactor), currentState.is_on);
     }
 }
 
-void displayBrightnessLevel(int brightness, uint8_t r, uint8_t g, uint8_t b) {
-    float scaleFactor = isNightMode ? NIGHT_BRIGHTNESS_SCALE : 1.0f;
-    int numLEDs = (brightness * NUM_LEDS) / 255;
-    for (int i = 0; i < NUM_LEDS; i++) {
-        if (i < numLEDs) {
-            uint8_t scaledR = (uint8_t)(r * scaleFactor);
-            uint8_t scaledG = (uint8_t)(g * scaleFactor);
-            uint8_t scaledB = (uint8_t)(b * scaleFactor);
-            strip.setPixelColor(i, strip.Color(scaledR, scaledG, scaledB));
-        } else {
-            strip.setPixelColor(i, strip.Color(0, 0, 0));
+// Shows another page in a single frame. Its states are already cached, so nothing is asked of Home Assistant
+void showPage(uint8_t page) {
+    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
+        currentPage = page;
+        if (!overlayActive()) {
+            fadeCancelAll();
+            for (int y = 0; y < ROWS; y++) {
+                for (int x = 0; x < COLS; x++) {
+                    strip.setPixelColor(getLedIndex(x, y), keyColor(readKeyState(x, y), x, y));
+                }
+            }
+            strip.show();
+        }
+        xSemaphoreGive(xMutex);
+    }
+}
+
+void setHealthIndicator(uint32_t color) {
+    if (HEALTH_LED_X < 0 || color == healthIndicatorColor) {
+        return;
+    }
+    healthIndicatorColor = color;
+    updateLED(HEALTH_LED_X, HEALTH_LED_Y);
+}
+
+static void writeFadePixel(int index, uint32_t color) {
+    strip.setPixelColor(index, color);
+}
+
+// Advances every fading key by one frame; the loop task calls this every LED_FRAME_INTERVAL_MS while fades run
+void renderLedFrame() {
+    if (!fadeActive()) {
+        return;
+    }
+    if (xSemaphoreTake(xMutex, portMAX_DELAY) == pdTRUE) {
+        unsigned long startTime = micros();
+        if (fadeTick(millis(), writeFadePixel)) {
+            strip.show();
+        }
+        profilerRecordLedFrame(micros() - startTime);
+        xSemaphoreGive(xMutex);
+    }
+}
+
+// Splits the keys into one stretch per bar, in order, and fills each stretch to its level.
+// A single bar uses every key, so adjusting one key looks the same as it always has.
+void displayLevelBars(const LevelBar* bars, int count) {
+    fadeCancelAll();
+    float scaleFactor = brightnessScale / 255.0f;
+    for (int bar = 0; bar < count; bar++) {
+        int first = bar * NUM_LEDS / count;
+        int length = (bar + 1) * NUM_LEDS / count - first;
+        int lit = (bars[bar].level * length) / 255;
+        uint32_t color = strip.Color((uint8_t)(bars[bar].r * scaleFactor),
+                                     (uint8_t)(bars[bar].g * scaleFactor),
+                                     (uint8_t)(bars[bar].b * scaleFactor));
+        for (int i = 0; i < length; i++) {
+            strip.setPixelColor(first + i, i < lit ? color : strip.Color(0, 0, 0));
         }
     }
     strip.show();
 }
 
 void displayAdjustmentLevel(int level, uint8_t r, uint8_t g, uint8_t b) {
-    float scaleFactor = isNightMode ? NIGHT_BRIGHTNESS_SCALE : 1.0f;
+    fadeCancelAll();
+    float scaleFactor = brightnessScale / 255.0f;
     int litLEDs = map(level, 0, 255, 0, NUM_LEDS);
     
     for (int i = 0; i < NUM_LEDS; i++) {
@@ -0,0 +1,23 @@
+#include "led_encoder.h"
+
+uint32_t ledItem(uint16_t duration0, bool level0, uint16_t duration1, bool level1) {
+    return (uint32_t)(duration0 & 0x7FFF) | ((uint32_t)level0 << 15) |
+           ((uint32_t)(duration1 & 0x7FFF) << 16) | ((uint32_t)level1 << 31);
+}
+
+// Writes LED_FRAME_ITEMS(count) items, most significant bit of each byte first
+size_t encodeLedFrame(const uint8_t* grb, uint16_t count, uint32_t* items) {
+    static const uint32_t zeroBit = ledItem(LED_T0H_TICKS, true, LED_T0L_TICKS, false);
+    static const uint32_t oneBit = ledItem(LED_T1H_TICKS, true, LED_T1L_TICKS, false);
+
+    size_t item = 0;
+    for (size_t i = 0; i < (size_t)count * 3; i++) {
+        uint8_t value = grb[i];
+        for (uint8_t mask = 0x80; mask; mask >>= 1) {
+            items[item++] = (value & mask) ? oneBit : zeroBit;
+        }
+    }
+    // A zero duration would end the transmission early, so the reset item closes with one more low tick
+    items[item++] = ledItem(LED_RESET_TICKS, false, 1, false);
+    return item;
+}
@@ -0,0 +1,77 @@
+#include "led_strip.h"
+
+static_assert(sizeof(rmt_item32_t) == sizeof(uint32_t), "encodeLedFrame writes items as 32 bit words");
+
+RmtStrip::RmtStrip(uint16_t count, int pin, rmt_channel_t channel)
+    : count(min(count, (uint16_t)NUM_LEDS)), pin(pin), channel(channel),
+      started(false), transmitting(false), nextBuffer(0) {
+    memset(pixels, 0, sizeof(pixels));
+}
+
+void RmtStrip::transmitDone(rmt_channel_t channel, void* arg) {
+    RmtStrip* strip = (RmtStrip*)arg;
+    if (channel == strip->channel) {
+        strip->transmitting = false;
+    }
+}
+
+void RmtStrip::begin() {
+    rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)pin, channel);
+    config.clk_div = LED_RMT_CLOCK_DIVIDER;
+    if (rmt_config(&config) != ESP_OK || rmt_driver_install(channel, 0, 0) != ESP_OK) {
+        SERIAL_PRINTLN("Failed to set up RMT for the LED strip");
+        return;
+    }
+    rmt_register_tx_end_callback(transmitDone, this);
+    started = true;
+}
+
+void RmtStrip::show() {
+    if (!started) {
+        return;
+    }
+
+    unsigned long startTime = micros();
+    // Encode while the previous frame may still be going out of the other buffer
+    uint32_t* frame = items[nextBuffer];
+    size_t length = encodeLedFrame(pixels, count, frame);
+
+    if (transmitting) {
+        rmt_wait_tx_done(channel, pdMS_TO_TICKS(LED_SHOW_TIMEOUT_MS));
+    }
+    transmitting = true;
+    if (rmt_write_items(channel, (const rmt_item32_t*)frame, length, false) != ESP_OK) {
+        transmitting = false;
+        return;
+    }
+    nextBuffer ^= 1;
+    metricsRecordShow(micros() - startTime);
+}
+
+bool RmtStrip::busy() const {
+    return transmitting;
+}
+
+void RmtStrip::setPixelColor(uint16_t n, uint32_t color) {
+    setPixelColor(n, color >> 16, color >> 8, color);
+}
+
+void RmtStrip::setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) {
+    if (n >= count) {
+        return;
+    }
+    pixels[n * 3] = g;
+    pixels[n * 3 + 1] = r;
+    pixels[n * 3 + 2] = b;
+}
+
+uint32_t RmtStrip::getPixelColor(uint16_t n) const {
+    if (n >= count) {
+        return 0;
+    }
+    return Color(pixels[n * 3 + 1], pixels[n * 3], pixels[n * 3 + 2]);
+}
+
+void RmtStrip::clear() {
+    memset(pixels, 0, sizeof(pixels));
+}
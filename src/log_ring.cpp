@@ -0,0 +1,79 @@
+#include "log_ring.h"
+
+static LogRecord logRing[LOG_RING_SIZE];
+static std::atomic<uint32_t> logWriteIndex(0);
+static uint32_t logReadIndex = 0; // Only touched by the draining task
+
+volatile uint8_t logLevelThreshold = LOG_LEVEL_INFO;
+volatile unsigned long logOverrunCount = 0;
+
+#define LOG_MESSAGE_FORMAT(id, format) format,
+static const char* const logFormats[LOG_MESSAGE_COUNT] = {
+    LOG_MESSAGES(LOG_MESSAGE_FORMAT)
+};
+#undef LOG_MESSAGE_FORMAT
+
+static const char* const logLevelNames[] = {"D", "I", "W", "E"};
+
+void logEvent(LogLevel level, LogMessageId id, int32_t a0, int32_t a1, int32_t a2,
+              int32_t a3, int32_t a4, int32_t a5) {
+    uint32_t index = logWriteIndex.fetch_add(1, std::memory_order_relaxed);
+    LogRecord& record = logRing[index & (LOG_RING_SIZE - 1)];
+
+    // Invalidate the slot first so a concurrent drain never sees a half-written record as complete
+    record.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record.timestamp = micros();
+    record.id = id;
+    record.level = level;
+    record.args[0] = a0;
+    record.args[1] = a1;
+    record.args[2] = a2;
+    record.args[3] = a3;
+    record.args[4] = a4;
+    record.args[5] = a5;
+    record.sequence.store(index + 1, std::memory_order_release);
+}
+
+int drainLogRing(int maxRecords) {
+    int drained = 0;
+    uint32_t writeIndex = logWriteIndex.load(std::memory_order_acquire);
+
+    if (writeIndex - logReadIndex > LOG_RING_SIZE) {
+        // Writers lapped us; skip to the oldest record that can still be intact
+        logOverrunCount += writeIndex - logReadIndex - LOG_RING_SIZE;
+        logReadIndex = writeIndex - LOG_RING_SIZE;
+    }
+
+    while (logReadIndex != writeIndex && drained < maxRecords) {
+        LogRecord& slot = logRing[logReadIndex & (LOG_RING_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != logReadIndex + 1) {
+            break; // Still being written
+        }
+
+        uint32_t timestamp = slot.timestamp;
+        uint16_t id = slot.id;
+        uint8_t level = slot.level;
+        int32_t args[LOG_MAX_ARGS];
+        memcpy(args, slot.args, sizeof(args));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != logReadIndex + 1) {
+            // Overwritten while copying; the next pass will resynchronise
+            logOverrunCount++;
+            logReadIndex++;
+            continue;
+        }
+
+        if (id < LOG_MESSAGE_COUNT && level <= LOG_LEVEL_ERROR) {
+            Serial.printf("[%lu] %s ", (unsigned long)timestamp, logLevelNames[level]);
+            Serial.printf(logFormats[id], args[0], args[1], args[2], args[3], args[4], args[5]);
+            Serial.println();
+        }
+
+        logReadIndex++;
+        drained++;
+    }
+
+    return drained;
+}
@@ -12,15 +12,24 @@
 #include "entity_state.h"
 #include "wifi_manager.h"
 #include "utils.h"
+#include "profiler.h"
+#include "log_ring.h"
+#include "night_mode.h"
+#include "event_loop.h"
+#include "heartbeat.h"
+#include "boot_timeline.h"
+#include "metrics.h"
 
 // Global variables
 unsigned long messageId = 1;
 SemaphoreHandle_t xMutex = NULL;
 SemaphoreHandle_t queueMutex = NULL;
+SemaphoreHandle_t commandQueueMutex = NULL;
+TaskHandle_t loopTaskHandle = NULL;
+TaskHandle_t buttonTaskHandle = NULL;
 volatile int queuedMessageCount = 0;
 volatile bool isBrightnessUpdateInProgress = false;
-bool isNightMode = false;
-int currentHour = -1;
+volatile uint8_t brightnessScale = 255;
 bool isChildLockMode = false;
 unsigned long childLockButtonPressTime = 0;
 
@@ -31,21 +40,57 @@ bool lastButtonState[ROWS][COLS] = {{false}};
 unsigned long buttonPressTime[ROWS][COLS] = {{0}};
 bool upButtonPressed = false;
 bool downButtonPressed = false;
+GestureKey gestureKeys[ROWS][COLS];
 unsigned long lastBrightnessAdjustTime = 0;
 bool isBrightnessAdjustmentMode = false;
-int currentAdjustmentBrightness = 0;
-unsigned long brightnessAdjustmentStartTime = 0;
-int lastAdjustedX = -1;
-int lastAdjustedY = -1;
 
-void setup() {
+// Loop task schedule
+static unsigned long lastMemoryPrint = 0;
+static unsigned long lastProfilerSample = 0;
+static unsigned long lastNightModeCheck = 0;
+static unsigned long brightnessUpdateStartTime = 0;
+static unsigned long lastLedFrame = 0;
+
+static unsigned long untilDue(unsigned long last, unsigned long interval) {
+    unsigned long elapsed = millis() - last;
+    return elapsed >= interval ? 0 : interval - elapsed;
+}
+
+// How long the loop task can block before something on its schedule is due
+static unsigned long nextLoopWait() {
+    unsigned long wait = min((unsigned long)LOOP_MAX_WAIT_MS, untilDue(lastNightModeCheck, NIGHT_MODE_CHECK_INTERVAL_MS));
     if (ENABLE_SERIAL_LOGGING) {
-        Serial.begin(115200);
-        delay(300); // Give some time for serial to initialize
+        wait = min(wait, untilDue(lastMemoryPrint, 5000));
+    }
+    if (ENABLE_PROFILER) {
+        wait = min(wait, untilDue(lastProfilerSample, PROFILER_SAMPLE_INTERVAL_MS));
+    }
+    if (ENABLE_PROFILER || ENABLE_LOG_RING) {
+        wait = min(wait, (unsigned long)SERIAL_POLL_INTERVAL_MS);
+    }
+    if (fadeActive()) {
+        wait = min(wait, untilDue(lastLedFrame, LED_FRAME_INTERVAL_MS));
+    }
+    wait = min(wait, overlayNextDue());
+    wait = min(wait, wifiNextDue());
+    wait = min(wait, heartbeatNextDue());
+    if (isBrightnessUpdateInProgress) {
+        wait = min(wait, untilDue(brightnessUpdateStartTime, BRIGHTNESS_UPDATE_TIMEOUT_MS));
+    } else if (queuedMessageCount > 0) {
+        wait = 0;
+    }
+    return wait;
+}
+
+void setup() {
+    if (ENABLE_SERIAL_LOGGING || ENABLE_PROFILER || ENABLE_LOG_RING) {
+        Serial.begin(115200); // Not waited on; early lines can be lost, the boot timeline is kept for the profiler report
     }
     SERIAL_PRINTLN("Starting setup...");
     printMemoryUsage();
 
+    loopTaskHandle = xTaskGetCurrentTaskHandle();
+
     strip.begin();
     strip.show();
 
@@ -63,27 +108,32 @@ void setup() {
         return;
     }
 
-    showConnectingAnimation();
-
-    if (connectToWiFi(10000)) {
-        SERIAL_PRINTLN("\nConnected to WiFi");
-        showWiFiConnectedAnimation();
-        initializeWebSocket();
-        initializeEntityStates();
-    } else {
-        SERIAL_PRINTLN("\nFailed to connect to WiFi");
-        showConnectionFailedAnimation();
+    commandQueueMutex = xSemaphoreCreateMutex();
+    if (commandQueueMutex == NULL) {
+        SERIAL_PRINTLN("Failed to create command queue mutex");
+        return;
     }
 
+    // Keys work from offline defaults until Home Assistant sends their state, so scanning starts
+    // right away and runs alongside WiFi, the WebSocket handshake and the state restore
+    initializeEntityStates();
+    initializeNightMode();
+    initializeGestures();
+    initializeEventLoop();
+    initializeWebSocket();
+
     xTaskCreate(
         buttonCheckTask,
         "ButtonCheckTask",
         4096,
         NULL,
         1,
-        NULL
+        &buttonTaskHandle
     );
 
+    startWiFi();
+    startMetricsServer();
+
     esp_task_wdt_init(30, true); // 30 second timeout, panic on timeout
     esp_task_wdt_add(NULL); // Add current thread to WDT watch
 
@@ -93,32 +143,50 @@ void setup() {
 
 void loop() {
     esp_task_wdt_reset(); // Reset watchdog timer
-    
-    static unsigned long lastMemoryPrint = 0;
-    static unsigned long lastMessageProcess = 0;
-    static unsigned long brightnessUpdateStartTime = 0;
-    
-    if (millis() - lastMemoryPrint > 5000) {  // Print memory usage every 5 seconds
+
+    if (millis() - lastMemoryPrint >= 5000) {  // Print memory usage every 5 seconds
         printMemoryUsage();
         lastMemoryPrint = millis();
     }
 
-    webSocket.loop();
+    if (ENABLE_PROFILER && millis() - lastProfilerSample >= PROFILER_SAMPLE_INTERVAL_MS) {
+        sampleProfiler();
+        lastProfilerSample = millis();
+    }
+
+    if (ENABLE_PROFILER || ENABLE_LOG_RING) {
+        handleSerialCommands();
+    }
+
+    if (serviceWiFi()) {
+        bootMark(BOOT_WIFI_UP);
+        startOverlayAnimation(OVERLAY_WIFI_CONNECTED);
+        reconnectWebSocket();
+    }
 
-    if (millis() - lastMessageProcess > 100) {  // Process messages every 100ms
-        // SERIAL_PRINTLN("Starting to process queued messages");
-        if (!isBrightnessUpdateInProgress) {
+    serviceWebSocket();
+    sendQueuedCommands();
+    heartbeatTick();
+    renderOverlayFrame();
+
+    if (millis() - lastNightModeCheck >= NIGHT_MODE_CHECK_INTERVAL_MS) {
+        updateNightMode();
+        lastNightModeCheck = millis();
+    }
+
+    if (fadeActive() && millis() - lastLedFrame >= LED_FRAME_INTERVAL_MS) {
+        renderLedFrame();
+        lastLedFrame = millis();
+    }
+
+    // The button task wakes the loop when an adjustment ends, so queued messages go out right away
+    if (!isBrightnessUpdateInProgress) {
+        if (queuedMessageCount > 0) {
             processQueuedMessages();
-        } else {
-            SERIAL_PRINTLN("Skipping message processing due to brightness update in progress");
-            // Add a timeout for brightness update
-            if (millis() - brightnessUpdateStartTime > BRIGHTNESS_UPDATE_TIMEOUT_MS) {  
-                SERIAL_PRINTLN("Brightness update timeout reached, resetting flag");
-                isBrightnessUpdateInProgress = false;
-            }
         }
-        lastMessageProcess = millis();
-        // SERIAL_PRINTLN("Finished processing queued messages");
+    } else if (brightnessUpdateStartTime != 0 && millis() - brightnessUpdateStartTime >= BRIGHTNESS_UPDATE_TIMEOUT_MS) {
+        SERIAL_PRINTLN("Brightness update timeout reached, resetting flag");
+        isBrightnessUpdateInProgress = false;
     }
 
     if (isBrightnessUpdateInProgress && brightnessUpdateStartTime == 0) {
@@ -127,11 +195,9 @@ void loop() {
         brightnessUpdateStartTime = 0;
     }
 
-    if (WiFi.status() != WL_CONNECTED) {
-        if (connectToWiFi(10000)) {
-            reconnectWebSocket();
-        }
+    if (ENABLE_SERIAL_LOGGING && ENABLE_LOG_RING) {
+        drainLogRing(LOG_DRAIN_BATCH);
     }
-    
-    delay(10);
+
+    waitForLoopEvent(nextLoopWait());
 }
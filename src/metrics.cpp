@@ -0,0 +1,208 @@
+#include "metrics.h"
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include "websocket_handler.h"
+#include "command_queue.h"
+#include "heartbeat.h"
+#include "boot_timeline.h"
+
+static const char* const frameTypeNames[METRICS_FRAME_TYPES] = { "text", "binary", "fragment", "ping", "pong" };
+static const unsigned long metricsParseBucketMicros[METRICS_PARSE_BUCKETS] = { 100, 500, 1000, 5000, 20000, 100000 };
+
+// Written from the loop and button tasks; relaxed is enough since every value stands alone
+static std::atomic<uint32_t> framesReceived[METRICS_FRAME_TYPES];
+static std::atomic<uint32_t> parseBuckets[METRICS_PARSE_BUCKETS + 1]; // Per bucket, made cumulative when served
+static std::atomic<uint32_t> parseMicrosTotal(0);
+static std::atomic<uint32_t> stripShows(0);
+static std::atomic<uint32_t> stripShowMicrosTotal(0);
+static std::atomic<uint32_t> keyPresses(0);
+
+static char response[METRICS_RESPONSE_SIZE]; // Only the metrics task touches this
+
+void metricsRecordFrame(WStype_t type) {
+    MetricsFrameType frame;
+    switch (type) {
+        case WStype_TEXT: frame = METRICS_FRAME_TEXT; break;
+        case WStype_BIN: frame = METRICS_FRAME_BINARY; break;
+        case WStype_FRAGMENT_TEXT_START:
+        case WStype_FRAGMENT_BIN_START:
+        case WStype_FRAGMENT:
+        case WStype_FRAGMENT_FIN: frame = METRICS_FRAME_FRAGMENT; break;
+        case WStype_PING: frame = METRICS_FRAME_PING; break;
+        case WStype_PONG: frame = METRICS_FRAME_PONG; break;
+        default: return;
+    }
+    framesReceived[frame].fetch_add(1, std::memory_order_relaxed);
+}
+
+void metricsRecordParse(unsigned long parseMicros) {
+    int bucket = 0;
+    while (bucket < METRICS_PARSE_BUCKETS && parseMicros > metricsParseBucketMicros[bucket]) {
+        bucket++;
+    }
+    parseBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    parseMicrosTotal.fetch_add(parseMicros, std::memory_order_relaxed);
+}
+
+void metricsRecordShow(unsigned long showMicros) {
+    stripShows.fetch_add(1, std::memory_order_relaxed);
+    stripShowMicrosTotal.fetch_add(showMicros, std::memory_order_relaxed);
+}
+
+void metricsRecordKeyPress() {
+    keyPresses.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Appends to buffer like snprintf, keeping track of the total length
+static void append(char* buffer, size_t size, size_t& length, const char* format, ...) {
+    if (length >= size) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + length, size - length, format, args);
+    va_end(args);
+    length = written < 0 ? size : min(size, length + written);
+}
+
+static void appendMetric(char* buffer, size_t size, size_t& length, const char* name, const char* type,
+                         const char* help, double value) {
+    append(buffer, size, length, "# HELP %s %s\n# TYPE %s %s\n%s %.10g\n", name, help, name, type, name, value);
+}
+
+// Returns the length written, or 0 if it didn't fit
+size_t formatMetrics(char* buffer, size_t size) {
+    size_t length = 0;
+
+    append(buffer, size, length, "# HELP deck_frames_received_total WebSocket frames received by type\n"
+                                 "# TYPE deck_frames_received_total counter\n");
+    for (int i = 0; i < METRICS_FRAME_TYPES; i++) {
+        append(buffer, size, length, "deck_frames_received_total{type=\"%s\"} %u\n", frameTypeNames[i],
+               framesReceived[i].load(std::memory_order_relaxed));
+    }
+
+    append(buffer, size, length, "# HELP deck_message_parse_seconds Time spent parsing each Home Assistant message\n"
+                                 "# TYPE deck_message_parse_seconds histogram\n");
+    uint32_t cumulative = 0;
+    for (int i = 0; i <= METRICS_PARSE_BUCKETS; i++) {
+        cumulative += parseBuckets[i].load(std::memory_order_relaxed);
+        if (i < METRICS_PARSE_BUCKETS) {
+            append(buffer, size, length, "deck_message_parse_seconds_bucket{le=\"%g\"} %u\n",
+                   metricsParseBucketMicros[i] / 1e6, cumulative);
+        } else {
+            append(buffer, size, length, "deck_message_parse_seconds_bucket{le=\"+Inf\"} %u\n", cumulative);
+        }
+    }
+    append(buffer, size, length, "deck_message_parse_seconds_sum %.6f\ndeck_message_parse_seconds_count %u\n",
+           parseMicrosTotal.load(std::memory_order_relaxed) / 1e6, cumulative);
+
+    appendMetric(buffer, size, length, "deck_inbound_queue_depth", "gauge",
+                 "Messages held while a brightness adjustment is in progress", queuedMessageCount);
+    appendMetric(buffer, size, length, "deck_inbound_queue_high_water", "gauge",
+                 "Most messages held at once", queuedMessageHighWaterMark);
+    appendMetric(buffer, size, length, "deck_inbound_queue_dropped_total", "counter",
+                 "Messages dropped because the inbound queue was full", droppedMessageCount);
+    appendMetric(buffer, size, length, "deck_outbound_queue_depth", "gauge",
+                 "Commands waiting to be sent", queuedCommandCount());
+    appendMetric(buffer, size, length, "deck_outbound_dropped_total", "counter",
+                 "Commands evicted from a full outbound queue", commandsDropped);
+    appendMetric(buffer, size, length, "deck_outbound_expired_total", "counter",
+                 "Commands discarded after waiting longer than OFFLINE_COMMAND_TTL_MS", commandsExpired);
+    appendMetric(buffer, size, length, "deck_outbound_superseded_total", "counter",
+                 "Level commands replaced by a newer value before being sent", commandsSuperseded);
+
+    appendMetric(buffer, size, length, "deck_websocket_connects_total", "counter",
+                 "WebSocket connections opened", webSocketConnects);
+    appendMetric(buffer, size, length, "deck_websocket_connect_seconds", "gauge",
+                 "Duration of the last connect, including the TLS handshake", webSocketConnectMicros / 1e6);
+    appendMetric(buffer, size, length, "deck_websocket_failovers_total", "counter",
+                 "Moves to another Home Assistant endpoint that authenticated", webSocketFailovers);
+    appendMetric(buffer, size, length, "deck_websocket_failover_seconds", "gauge",
+                 "Time from losing an endpoint until the next one authenticated", webSocketFailoverMillis / 1e3);
+    appendMetric(buffer, size, length, "deck_websocket_endpoint", "gauge",
+                 "Index of the endpoint in use, 0 for HA_HOST", webSocketEndpoint);
+    appendMetric(buffer, size, length, "deck_heartbeat_reconnects_total", "counter",
+                 "Reconnects forced by unanswered pings", heartbeatReconnects);
+    appendMetric(buffer, size, length, "deck_heartbeat_rtt_seconds", "gauge",
+                 "Smoothed ping round trip time", heartbeatRttMicros / 1e6);
+    appendMetric(buffer, size, length, "deck_heartbeat_jitter_seconds", "gauge",
+                 "Smoothed deviation of the ping round trip time", heartbeatJitterMicros / 1e6);
+
+    appendMetric(buffer, size, length, "deck_strip_shows_total", "counter",
+                 "LED frames sent to the strip", stripShows.load(std::memory_order_relaxed));
+    appendMetric(buffer, size, length, "deck_strip_show_seconds_total", "counter",
+                 "Time spent in strip.show()", stripShowMicrosTotal.load(std::memory_order_relaxed) / 1e6);
+    appendMetric(buffer, size, length, "deck_key_presses_total", "counter",
+                 "Debounced key presses", keyPresses.load(std::memory_order_relaxed));
+
+    appendMetric(buffer, size, length, "deck_free_heap_bytes", "gauge",
+                 "Free heap", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    appendMetric(buffer, size, length, "deck_largest_free_block_bytes", "gauge",
+                 "Largest allocatable heap block", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    appendMetric(buffer, size, length, "deck_uptime_seconds", "counter",
+                 "Time since boot", millis() / 1e3);
+    appendMetric(buffer, size, length, "deck_boot_to_first_usable_key_seconds", "gauge",
+                 "Time from boot until keys were usable, 0 until then", bootToFirstUsableKeyMs() / 1e3);
+
+    return length < size ? length : 0;
+}
+
+static void serveClient(int client) {
+    // Any request gets the metrics; only the start of it is read so the connection can close cleanly
+    char request[128];
+    if (recv(client, request, sizeof(request), 0) <= 0) {
+        return;
+    }
+    bool isMetrics = strncmp(request, "GET /metrics", 12) == 0;
+
+    size_t bodyLength = isMetrics ? formatMetrics(response, sizeof(response)) : 0;
+    char header[128];
+    int headerLength = snprintf(header, sizeof(header),
+                                "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\n"
+                                "Connection: close\r\n\r\n",
+                                !isMetrics ? "404 Not Found" : bodyLength > 0 ? "200 OK" : "500 Internal Server Error",
+                                (unsigned)bodyLength);
+    send(client, header, headerLength, 0);
+    if (bodyLength > 0) {
+        send(client, response, bodyLength, 0);
+    }
+}
+
+static void metricsTask(void* parameter) {
+    while (true) {
+        int server = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(METRICS_PORT);
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (server < 0 || bind(server, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(server, 2) < 0) {
+            SERIAL_PRINTLN("Metrics server could not listen, retrying");
+            if (server >= 0) {
+                close(server);
+            }
+            vTaskDelay(pdMS_TO_TICKS(5000));
+            continue;
+        }
+
+        while (true) {
+            int client = accept(server, NULL, NULL);
+            if (client < 0) {
+                break;
+            }
+            struct timeval timeout = {2, 0}; // A stalled scraper must not hold the task forever
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            serveClient(client);
+            close(client);
+        }
+        close(server);
+    }
+}
+
+void startMetricsServer() {
+    if (ENABLE_METRICS_ENDPOINT) {
+        xTaskCreate(metricsTask, "MetricsTask", METRICS_TASK_STACK_SIZE, NULL, tskIDLE_PRIORITY, NULL);
+    }
+}
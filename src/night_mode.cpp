@@ -0,0 +1,58 @@
+#include "night_mode.h"
+#include <time.h>
+
+// LED brightness scale for every minute of the day, 255 = full brightness
+static uint8_t brightnessCurve[MINUTES_PER_DAY];
+
+static float smoothStep(float t) {
+    t = constrain(t, 0.0f, 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+static void buildBrightnessCurve() {
+    const int nightStart = NIGHT_START_HOUR * 60;
+    const int nightLength = (NIGHT_END_HOUR * 60 - nightStart + MINUTES_PER_DAY) % MINUTES_PER_DAY;
+
+    for (int minute = 0; minute < MINUTES_PER_DAY; minute++) {
+        int sinceNightStart = (minute - nightStart + MINUTES_PER_DAY) % MINUTES_PER_DAY;
+        float nightWeight;
+        if (sinceNightStart < nightLength) {
+            // Fade down into night
+            nightWeight = NIGHT_RAMP_MINUTES > 0 ? smoothStep((float)sinceNightStart / NIGHT_RAMP_MINUTES) : 1.0f;
+        } else {
+            // Fade back up after night ends
+            int sinceNightEnd = sinceNightStart - nightLength;
+            nightWeight = nightLength > 0 && NIGHT_RAMP_MINUTES > 0 ? 1.0f - smoothStep((float)sinceNightEnd / NIGHT_RAMP_MINUTES) : 0.0f;
+        }
+        float scale = 1.0f - nightWeight * (1.0f - NIGHT_BRIGHTNESS_SCALE);
+        brightnessCurve[minute] = (uint8_t)(scale * 255.0f + 0.5f);
+    }
+}
+
+void initializeNightMode() {
+    buildBrightnessCurve();
+#ifdef TIMEZONE_NOT_CONFIGURED
+    SERIAL_PRINTLN("TIMEZONE is not set in config.h, night mode hours are UTC");
+#endif
+    configTzTime(TIMEZONE, NTP_SERVER);
+}
+
+void updateNightMode() {
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo, 0)) {
+        return; // Not synced yet, keep the current scale
+    }
+
+    uint8_t newScale = brightnessCurve[timeinfo.tm_hour * 60 + timeinfo.tm_min];
+    if (newScale == brightnessScale) {
+        return;
+    }
+
+    SERIAL_PRINTF("Brightness scale changed to %d/255 (Time: %02d:%02d)\n", newScale, timeinfo.tm_hour, timeinfo.tm_min);
+    brightnessScale = newScale;
+    for (int y = 0; y < ROWS; y++) {
+        for (int x = 0; x < COLS; x++) {
+            updateLED(x, y);
+        }
+    }
+}
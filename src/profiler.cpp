@@ -0,0 +1,186 @@
+#include "profiler.h"
+#include "websocket_handler.h"
+#include "config.h"
+#include "heartbeat.h"
+#include "boot_timeline.h"
+#include "command_queue.h"
+
+ProfilerSample profilerSamples[PROFILER_HISTORY_SIZE];
+int profilerSampleCount = 0;
+static int profilerSampleHead = 0;
+
+// Sampling and reporting both run on the loop task, so none of this needs locking
+static TaskStatus_t taskStatus[PROFILER_MAX_TASKS];
+static TaskHandle_t previousTaskHandles[PROFILER_MAX_TASKS];
+static uint32_t previousTaskRunTimes[PROFILER_MAX_TASKS];
+static UBaseType_t previousTaskCount = 0;
+static uint32_t previousTotalRunTime = 0;
+static uint32_t minLargestFreeBlock = UINT32_MAX;
+
+// Written from the WebSocket event handler, which also runs on the loop task
+static unsigned long stateMessages = 0;
+static unsigned long stateBytes = 0;
+static unsigned long stateHandleMicros = 0;
+static unsigned long maxStateHandleMicros = 0;
+
+// Each counter has a single writer task; the sampler only reads them
+static volatile unsigned long loopWakeups = 0;
+static volatile unsigned long buttonWakeups = 0;
+static volatile unsigned long maxKeyWakeMicros = 0;
+static unsigned long maxLedFrameMicros = 0;
+static unsigned long previousLoopWakeups = 0;
+static unsigned long previousButtonWakeups = 0;
+static unsigned long previousSampleTime = 0;
+
+void profilerRecordStateMessage(size_t bytes, unsigned long handleMicros) {
+    stateMessages++;
+    stateBytes += bytes;
+    stateHandleMicros += handleMicros;
+    maxStateHandleMicros = max(maxStateHandleMicros, handleMicros);
+}
+
+void profilerRecordLoopWakeup() {
+    loopWakeups++;
+}
+
+void profilerRecordButtonWakeup() {
+    buttonWakeups++;
+}
+
+void profilerRecordKeyWake(unsigned long latencyMicros) {
+    if (latencyMicros > maxKeyWakeMicros) {
+        maxKeyWakeMicros = latencyMicros;
+    }
+}
+
+void profilerRecordLedFrame(unsigned long frameMicros) {
+    maxLedFrameMicros = max(maxLedFrameMicros, frameMicros);
+}
+
+static uint32_t previousRunTimeFor(TaskHandle_t handle) {
+    for (UBaseType_t i = 0; i < previousTaskCount; i++) {
+        if (previousTaskHandles[i] == handle) {
+            return previousTaskRunTimes[i];
+        }
+    }
+    return 0;
+}
+
+static void sampleTasks(ProfilerSample& sample) {
+    sample.numTasks = 0;
+#if configUSE_TRACE_FACILITY
+    uint32_t totalRunTime = 0;
+    UBaseType_t taskCount = uxTaskGetSystemState(taskStatus, PROFILER_MAX_TASKS, &totalRunTime);
+    uint32_t elapsedRunTime = totalRunTime - previousTotalRunTime;
+
+    for (UBaseType_t i = 0; i < taskCount; i++) {
+        TaskProfile& task = sample.tasks[i];
+        strncpy(task.name, taskStatus[i].pcTaskName, sizeof(task.name) - 1);
+        task.name[sizeof(task.name) - 1] = '\0';
+        task.stackHighWaterMark = taskStatus[i].usStackHighWaterMark;
+#if configGENERATE_RUN_TIME_STATS
+        uint32_t taskRunTime = taskStatus[i].ulRunTimeCounter - previousRunTimeFor(taskStatus[i].xHandle);
+        task.cpuPercent = elapsedRunTime > 0 ? (uint64_t)taskRunTime * 100 / elapsedRunTime : 0;
+        previousTaskHandles[i] = taskStatus[i].xHandle;
+        previousTaskRunTimes[i] = taskStatus[i].ulRunTimeCounter;
+#else
+        task.cpuPercent = 0;
+#endif
+    }
+
+    sample.numTasks = taskCount;
+    previousTaskCount = taskCount;
+    previousTotalRunTime = totalRunTime;
+#endif
+}
+
+void sampleProfiler() {
+    ProfilerSample& sample = profilerSamples[profilerSampleHead];
+
+    sample.timestamp = millis();
+    sample.freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    sample.minFreeHeap = esp_get_minimum_free_heap_size();
+    sample.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    sample.fragmentation = sample.freeHeap > 0 ? 100 - (uint64_t)sample.largestFreeBlock * 100 / sample.freeHeap : 0;
+    minLargestFreeBlock = min(minLargestFreeBlock, sample.largestFreeBlock);
+
+    sample.queueDepth = queuedMessageCount;
+    sample.queueHighWaterMark = queuedMessageHighWaterMark;
+    sample.droppedMessages = droppedMessageCount;
+
+    sample.stateMessages = stateMessages;
+    sample.stateBytes = stateBytes;
+    sample.stateHandleMicros = stateHandleMicros;
+    sample.maxStateHandleMicros = maxStateHandleMicros;
+
+    unsigned long elapsed = sample.timestamp - previousSampleTime;
+    unsigned long loopCount = loopWakeups;
+    unsigned long buttonCount = buttonWakeups;
+    sample.loopWakeupsPerSecond = elapsed > 0 ? (loopCount - previousLoopWakeups) * 1000 / elapsed : 0;
+    sample.buttonWakeupsPerSecond = elapsed > 0 ? (buttonCount - previousButtonWakeups) * 1000 / elapsed : 0;
+    sample.maxKeyWakeMicros = maxKeyWakeMicros;
+    sample.maxLedFrameMicros = maxLedFrameMicros;
+    previousLoopWakeups = loopCount;
+    previousButtonWakeups = buttonCount;
+    previousSampleTime = sample.timestamp;
+
+    sample.buttonTaskStackFree = buttonTaskHandle ? uxTaskGetStackHighWaterMark(buttonTaskHandle) : 0;
+    sample.loopTaskStackFree = loopTaskHandle ? uxTaskGetStackHighWaterMark(loopTaskHandle) : 0;
+
+    sampleTasks(sample);
+
+    profilerSampleHead = (profilerSampleHead + 1) % PROFILER_HISTORY_SIZE;
+    if (profilerSampleCount < PROFILER_HISTORY_SIZE) {
+        profilerSampleCount++;
+    }
+}
+
+void printProfilerReport() {
+    if (profilerSampleCount == 0) {
+        Serial.println("Profiler: no samples yet");
+        return;
+    }
+
+    Serial.println("time_ms  free  min_free  largest  frag%  queue  queue_max  dropped  btn_stack  loop_stack");
+    int oldest = (profilerSampleHead - profilerSampleCount + PROFILER_HISTORY_SIZE) % PROFILER_HISTORY_SIZE;
+    for (int i = 0; i < profilerSampleCount; i++) {
+        const ProfilerSample& sample = profilerSamples[(oldest + i) % PROFILER_HISTORY_SIZE];
+        Serial.printf("%lu  %u  %u  %u  %u  %d  %d  %lu  %u  %u\n",
+                      sample.timestamp, sample.freeHeap, sample.minFreeHeap, sample.largestFreeBlock,
+                      sample.fragmentation, sample.queueDepth, sample.queueHighWaterMark,
+                      sample.droppedMessages, sample.buttonTaskStackFree, sample.loopTaskStackFree);
+    }
+    Serial.printf("Smallest largest-free-block since boot: %u\n", minLargestFreeBlock);
+
+    const ProfilerSample& latest = profilerSamples[(profilerSampleHead - 1 + PROFILER_HISTORY_SIZE) % PROFILER_HISTORY_SIZE];
+    Serial.printf("State messages (%s): %lu, bytes: %lu, avg handle us: %lu, max handle us: %lu\n",
+                  USE_TEMPLATE_SUBSCRIPTION ? "template" : "subscribe_entities",
+                  latest.stateMessages, latest.stateBytes,
+                  latest.stateMessages > 0 ? latest.stateHandleMicros / latest.stateMessages : 0,
+                  latest.maxStateHandleMicros);
+    Serial.printf("Wakeups/s loop: %u, button: %u, max key wake us: %lu, max LED frame us: %lu\n",
+                  latest.loopWakeupsPerSecond, latest.buttonWakeupsPerSecond, latest.maxKeyWakeMicros,
+                  latest.maxLedFrameMicros);
+    Serial.printf("Heartbeat rtt us: %lu, jitter us: %lu, reconnects: %lu\n",
+                  heartbeatRttMicros, heartbeatJitterMicros, heartbeatReconnects);
+    Serial.printf("Outbound commands queued: %d, superseded: %lu, expired: %lu, dropped: %lu\n",
+                  queuedCommandCount(), commandsSuperseded, commandsExpired, commandsDropped);
+    Serial.printf("WebSocket connects (%s): %lu, last us: %lu, max us: %lu, heap held: %ld\n",
+                  HA_USE_TLS ? "tls" : "tcp", webSocketConnects, webSocketConnectMicros,
+                  webSocketMaxConnectMicros, webSocketConnectHeapBytes);
+    Serial.printf("WebSocket endpoint: %d, failovers: %lu, last failover ms: %lu\n",
+                  webSocketEndpoint, webSocketFailovers, webSocketFailoverMillis);
+    printBootTimeline();
+#if configGENERATE_RUN_TIME_STATS
+    Serial.println("task  cpu%  stack_free");
+    for (int i = 0; i < latest.numTasks; i++) {
+        Serial.printf("%-16s  %u  %u\n", latest.tasks[i].name, latest.tasks[i].cpuPercent, latest.tasks[i].stackHighWaterMark);
+    }
+#else
+    // The stock core doesn't count run time per task, and a column of zeros would read as idle
+    Serial.println("task  stack_free");
+    for (int i = 0; i < latest.numTasks; i++) {
+        Serial.printf("%-16s  %u\n", latest.tasks[i].name, latest.tasks[i].stackHighWaterMark);
+    }
+#endif
+}
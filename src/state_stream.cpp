@@ -0,0 +1,192 @@
+#include "state_stream.h"
+
+enum StreamKey : uint8_t {
+    STREAM_KEY_OTHER,
+    STREAM_KEY_TYPE,
+    STREAM_KEY_ID,
+    STREAM_KEY_EVENT,
+    STREAM_KEY_RESULT,
+    STREAM_KEY_SUCCESS,
+    STREAM_KEY_A,         // "a": entities added (event level) or attributes (entity level)
+    STREAM_KEY_C,         // "c": entities changed
+    STREAM_KEY_NEW,       // "+": new values within a change
+    STREAM_KEY_S,         // "s": state
+    STREAM_KEY_RGB,
+    STREAM_KEY_BRIGHTNESS,
+    STREAM_KEY_VOLUME
+};
+
+// Messages are only read on the loop task
+static JsonStream stream;
+static bool streamOpen = false;
+static StreamKey keys[JSON_STREAM_MAX_DEPTH + 2]; // Key currently open at each depth
+static char messageType[16];
+static unsigned long messageIdValue = 0;
+static bool messageSuccess = false;
+
+static char entityId[MAX_ENTITY_ID_LENGTH];
+static bool entityMapped = false;
+static EntityUpdate update;
+static int rgbIndex = 0;
+
+static StreamKey classifyKey(const char* key) {
+    if (key[0] != '\0' && key[1] == '\0') {
+        switch (key[0]) {
+            case 'a': return STREAM_KEY_A;
+            case 'c': return STREAM_KEY_C;
+            case 's': return STREAM_KEY_S;
+            case '+': return STREAM_KEY_NEW;
+        }
+        return STREAM_KEY_OTHER;
+    }
+    if (strcmp(key, "type") == 0) return STREAM_KEY_TYPE;
+    if (strcmp(key, "id") == 0) return STREAM_KEY_ID;
+    if (strcmp(key, "event") == 0) return STREAM_KEY_EVENT;
+    if (strcmp(key, "result") == 0) return STREAM_KEY_RESULT;
+    if (strcmp(key, "success") == 0) return STREAM_KEY_SUCCESS;
+    if (strcmp(key, "rgb_color") == 0) return STREAM_KEY_RGB;
+    if (strcmp(key, "brightness") == 0) return STREAM_KEY_BRIGHTNESS;
+    if (strcmp(key, "volume_level") == 0) return STREAM_KEY_VOLUME;
+    return STREAM_KEY_OTHER;
+}
+
+static bool isMappedEntity(const char* entity_id) {
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        if (findMappingMember(i, entity_id) >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void applyEntity() {
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        int member = findMappingMember(i, entityId);
+        if (member >= 0) {
+            update.member = member;
+            updateLEDState(entityMappings[i].page, entityMappings[i].x, entityMappings[i].y, &update);
+        }
+    }
+}
+
+// Depth of an entity's "s" and "a" keys: {"event":{"a":{"light.x":{"s":..}}}} or {"event":{"c":{"light.x":{"+":{"s":..}}}}}
+static int entityFieldDepth() {
+    return keys[2] == STREAM_KEY_C ? 5 : 4;
+}
+
+static void handleEntityToken(JsonStreamToken token, const char* text, int depth) {
+    int fieldDepth = entityFieldDepth();
+    if (keys[2] == STREAM_KEY_C && (depth < 5 || keys[4] != STREAM_KEY_NEW)) {
+        return; // "-" lists removed attributes, which the LEDs don't track
+    }
+
+    if (depth == fieldDepth) {
+        if (keys[depth] == STREAM_KEY_S && token == JSON_STRING) {
+            update.has_state = true;
+            update.is_on = strcmp(text, "on") == 0 || strcmp(text, "playing") == 0;
+        } else if (keys[depth] == STREAM_KEY_A && token == JSON_OBJECT_START) {
+            update.has_attributes = true;
+        }
+        return;
+    }
+
+    if (keys[fieldDepth] != STREAM_KEY_A) {
+        return;
+    }
+
+    // A null attribute still counts as present and reads as zero
+    bool isValue = token == JSON_NUMBER || token == JSON_NULL;
+    if (depth == fieldDepth + 1) {
+        if (keys[depth] == STREAM_KEY_RGB && (token == JSON_ARRAY_START || token == JSON_NULL)) {
+            update.has_rgb = true;
+            update.r = update.g = update.b = 0;
+            rgbIndex = 0;
+        } else if (keys[depth] == STREAM_KEY_BRIGHTNESS && isValue) {
+            update.has_brightness = true;
+            update.brightness = token == JSON_NUMBER ? (uint8_t)atoi(text) : 0;
+        } else if (keys[depth] == STREAM_KEY_VOLUME && isValue) {
+            update.has_volume = true;
+            update.volume = token == JSON_NUMBER ? strtof(text, nullptr) : 0.0f;
+        }
+    } else if (depth == fieldDepth + 2 && keys[fieldDepth + 1] == STREAM_KEY_RGB && token == JSON_NUMBER) {
+        uint8_t component = atoi(text);
+        if (rgbIndex == 0) update.r = component;
+        else if (rgbIndex == 1) update.g = component;
+        else if (rgbIndex == 2) update.b = component;
+        rgbIndex++;
+    }
+}
+
+static void handleToken(JsonStreamToken token, const char* text, size_t length, int depth) {
+    bool inEntities = keys[1] == STREAM_KEY_EVENT && (keys[2] == STREAM_KEY_A || keys[2] == STREAM_KEY_C);
+
+    if (token == JSON_KEY) {
+        keys[depth] = classifyKey(text);
+        if (depth == 2 && keys[1] == STREAM_KEY_EVENT && keys[2] == STREAM_KEY_RESULT) {
+            beginCompactState();
+        } else if (depth == 3 && inEntities) {
+            entityMapped = length > 0 && length < sizeof(entityId) && isMappedEntity(text);
+            if (entityMapped) {
+                memcpy(entityId, text, length + 1);
+                memset(&update, 0, sizeof(update));
+            }
+        }
+        return;
+    }
+
+    if (token == JSON_OBJECT_START || token == JSON_ARRAY_START) {
+        keys[depth + 1] = STREAM_KEY_OTHER;
+    }
+
+    if (depth == 1 && keys[1] == STREAM_KEY_TYPE && token == JSON_STRING) {
+        strncpy(messageType, text, sizeof(messageType) - 1);
+        messageType[sizeof(messageType) - 1] = '\0';
+    } else if (depth == 1 && keys[1] == STREAM_KEY_ID && token == JSON_NUMBER) {
+        messageIdValue = strtoul(text, nullptr, 10);
+    } else if (depth == 1 && keys[1] == STREAM_KEY_SUCCESS) {
+        messageSuccess = token == JSON_TRUE;
+    } else if (depth == 2 && keys[1] == STREAM_KEY_EVENT && keys[2] == STREAM_KEY_RESULT &&
+               (token == JSON_STRING_PART || token == JSON_STRING)) {
+        feedCompactState(text, length);
+    } else if (inEntities && entityMapped && depth > 3) {
+        handleEntityToken(token, text, depth);
+    } else if (inEntities && entityMapped && depth == 3 && token == JSON_OBJECT_END) {
+        applyEntity();
+        entityMapped = false;
+    }
+}
+
+void beginStateStream() {
+    jsonStreamInit(stream, handleToken);
+    memset(keys, 0, sizeof(keys));
+    messageType[0] = '\0';
+    messageIdValue = 0;
+    messageSuccess = false;
+    entityMapped = false;
+    streamOpen = true;
+}
+
+bool feedStateStream(const uint8_t* data, size_t length) {
+    return jsonStreamFeed(stream, (const char*)data, length);
+}
+
+bool finishStateStream() {
+    streamOpen = false;
+    return jsonStreamFinish(stream);
+}
+
+bool isStateStreamOpen() {
+    return streamOpen;
+}
+
+const char* stateStreamMessageType() {
+    return messageType;
+}
+
+unsigned long stateStreamMessageId() {
+    return messageIdValue;
+}
+
+bool stateStreamMessageSucceeded() {
+    return messageSuccess;
+}
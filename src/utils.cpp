@@ -1,4 +1,6 @@
 #include "utils.h"
+#include "profiler.h"
+#include "log_ring.h"
 
 
 
@@ -8,3 +10,23 @@ void printMemoryUsage() {
                   esp_get_free_heap_size(), 
                   heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
 }
+
+void handleSerialCommands() {
+    while (Serial.available() > 0) {
+        switch (Serial.read()) {
+            case 'p':
+                printProfilerReport();
+                break;
+            case 'l':
+                drainLogRing(LOG_RING_SIZE);
+                Serial.printf("Log overruns: %lu\n", logOverrunCount);
+                break;
+            case 'v':
+                logLevelThreshold = logLevelThreshold == LOG_LEVEL_DEBUG ? LOG_LEVEL_INFO : LOG_LEVEL_DEBUG;
+                Serial.printf("Log level: %s\n", logLevelThreshold == LOG_LEVEL_DEBUG ? "debug" : "info");
+                break;
+            default:
+                break;
+        }
+    }
+}
@@ -1,32 +1,210 @@
 #include "websocket_handler.h"
 
-WebSocketsClient webSocket;
+// Without either pin a TLS connection would send the access token to whichever server answers
+static_assert(!HA_USE_TLS || sizeof(HA_CA_CERT) > 1 || sizeof(HA_CERT_FINGERPRINT) > 1,
+              "HA_USE_TLS needs HA_CA_CERT or HA_CERT_FINGERPRINT in secrets.h");
+
+DeckWebSocketsClient webSocket;
 QueuedMessage queuedMessages[MAX_QUEUED_MESSAGES];
 
+// queuedMessages is a ring in arrival order, and their payloads are kept in this arena instead of
+// being malloc'd. The arena is used as a ring too: a payload is stored in one piece, so one that
+// doesn't fit before the end starts again at the front, and the oldest payload marks where the
+// used region begins.
+static char queueArena[QUEUE_ARENA_SIZE];
+static size_t queueArenaHead = 0; // Where the next payload goes
+static int oldestQueuedMessage = 0;
+
+volatile int queuedMessageHighWaterMark = 0;
+volatile unsigned long droppedMessageCount = 0;
+static bool fragmentedTextMessage = false;
+
+unsigned long webSocketConnectMicros = 0;
+unsigned long webSocketMaxConnectMicros = 0;
+long webSocketConnectHeapBytes = 0;
+unsigned long webSocketConnects = 0;
+static bool certificateRejected = false;
+
+static const HaEndpoint haEndpoints[] = {{HA_HOST, HA_PORT}, HA_STANDBY_ENDPOINTS};
+static const int NUM_HA_ENDPOINTS = sizeof(haEndpoints) / sizeof(haEndpoints[0]);
+
+unsigned long webSocketFailovers = 0;
+unsigned long webSocketFailoverMillis = 0;
+int webSocketEndpoint = 0;
+
+// Failover state, all on the loop task
+static bool endpointStarted = false;       // reconnectWebSocket has run since WiFi came up
+static bool endpointConnected = false;     // The current endpoint's socket is open
+static bool endpointAuthenticated = false;
+static unsigned long endpointStartTime = 0; // Last progress: begin(), socket opened, or connected
+static int endpointsTried = 0;             // Endpoints given up on since the last one authenticated
+static bool failoverPending = false;
+static bool failingOver = false;           // The keys still show their cached states while this is set
+static unsigned long failoverStartTime = 0;
+
+#if defined(HAS_SSL)
+// WiFiClientSecure opens its socket through the mbedTLS context and never sets WiFiClient's
+// handle, so fd() is always -1 for it. The context is protected; a pointer to member formed in a
+// subclass reads it without casting the client.
+struct SecureClientSocket : WiFiClientSecure {
+    static int fd(WiFiClientSecure* client) {
+        sslclient_context* WiFiClientSecure::* context = &SecureClientSocket::sslclient;
+        return (client->*context) ? (client->*context)->socket : -1;
+    }
+};
+#endif
+
+int DeckWebSocketsClient::socketFd() {
+#if defined(HAS_SSL)
+    if (_client.ssl) {
+        return SecureClientSocket::fd(_client.ssl);
+    }
+#endif
+    return _client.tcp ? _client.tcp->fd() : -1;
+}
+
+// WiFiClient may already have read bytes off the socket, in which case select() would not see them
+bool DeckWebSocketsClient::hasBufferedData() {
+    return _client.tcp && _client.tcp->available() > 0;
+}
+
+bool DeckWebSocketsClient::serverCertificateMatches(const char* fingerprint) {
+#if defined(HAS_SSL)
+    return _client.ssl && _client.ssl->verify(fingerprint, nullptr);
+#else
+    return false;
+#endif
+}
+
+// Connecting waits for WiFi; the loop task calls reconnectWebSocket once it has an address
 void initializeWebSocket() {
-    webSocket.begin(HA_HOST, HA_PORT, "/api/websocket");
     webSocket.onEvent(webSocketEvent);
-    webSocket.setReconnectInterval(5000);
+    webSocket.setReconnectInterval(WEBSOCKET_BOOT_RECONNECT_INTERVAL_MS);
 }
 
 void reconnectWebSocket() {
+    setCommandLinkState(COMMAND_LINK_DOWN);
+    endpointConnected = false; // Closing it ourselves is not a reason to fail over
     webSocket.disconnect();
-    webSocket.begin(HA_HOST, HA_PORT, "/api/websocket");
+    const HaEndpoint& endpoint = haEndpoints[webSocketEndpoint];
+    SERIAL_PRINTF("Connecting to Home Assistant at %s:%u\n", endpoint.host, endpoint.port);
+    if (HA_USE_TLS) {
+        webSocket.beginSslWithCA(endpoint.host, endpoint.port, "/api/websocket", HA_CA_CERT[0] != '\0' ? HA_CA_CERT : nullptr);
+    } else {
+        webSocket.begin(endpoint.host, endpoint.port, "/api/websocket");
+    }
+    endpointStarted = true;
+    endpointAuthenticated = false;
+    endpointStartTime = millis();
+}
+
+// Gives up on the current endpoint and connects to the next one. Cached states and buffered
+// presses carry over and the same subscription is sent again, so only keys that changed meanwhile
+// are redrawn.
+// Once every endpoint has failed in a row the deck shows the connection failure as usual.
+void failOverWebSocket() {
+    if (NUM_HA_ENDPOINTS < 2) {
+        reconnectWebSocket();
+        return;
+    }
+    if (endpointsTried == 0) {
+        failingOver = true;
+        failoverStartTime = millis();
+        setHealthIndicator(COLOR_ORANGE);
+    }
+    endpointsTried++;
+    webSocketEndpoint = (webSocketEndpoint + 1) % NUM_HA_ENDPOINTS;
+    reconnectWebSocket();
+    if (failingOver && endpointsTried >= NUM_HA_ENDPOINTS) {
+        SERIAL_PRINTLN("No Home Assistant endpoint is answering");
+        failingOver = false;
+        showWebSocketConnectionFailedAnimation();
+    }
+}
+
+// Called on auth_ok; the new endpoint is the one to stay on
+void webSocketAuthenticated() {
+    endpointAuthenticated = true;
+    if (endpointsTried > 0) {
+        webSocketFailovers++;
+        webSocketFailoverMillis = millis() - failoverStartTime;
+        SERIAL_PRINTF("Failed over to %s:%u in %lu ms\n", haEndpoints[webSocketEndpoint].host,
+                      haEndpoints[webSocketEndpoint].port, webSocketFailoverMillis);
+    }
+    endpointsTried = 0;
+    failingOver = false;
+}
+
+// Runs the WebSocket client on the loop task, timing the call that opens a new socket
+void serviceWebSocket() {
+    bool hadSocket = webSocket.socketFd() >= 0;
+    uint32_t freeHeapBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    unsigned long startTime = micros();
+
+    webSocket.loop();
+
+    if (!hadSocket && webSocket.socketFd() >= 0) {
+        webSocketConnectMicros = micros() - startTime;
+        webSocketMaxConnectMicros = max(webSocketMaxConnectMicros, webSocketConnectMicros);
+        webSocketConnectHeapBytes = (long)freeHeapBefore - (long)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        webSocketConnects++;
+        endpointStartTime = millis(); // The failover timeout doesn't count the blocking connect and TLS handshake
+        SERIAL_PRINTF("WebSocket %s connect took %lu us and %ld bytes of heap\n",
+                      HA_USE_TLS ? "TLS" : "TCP", webSocketConnectMicros, webSocketConnectHeapBytes);
+    }
+
+    // Dropped here rather than from the event callback, which runs inside webSocket.loop()
+    if (certificateRejected) {
+        certificateRejected = false;
+        webSocket.disconnect();
+    }
+
+    if (NUM_HA_ENDPOINTS > 1 && endpointStarted && (failoverPending ||
+        (!endpointAuthenticated && millis() - endpointStartTime > WEBSOCKET_FAILOVER_TIMEOUT_MS))) {
+        failoverPending = false;
+        failOverWebSocket();
+    }
 }
 
 
 void webSocketEvent(WStype_t type, uint8_t * payload, size_t length) {
     SERIAL_PRINTF("WebSocket event type: %d\n", type);
+    metricsRecordFrame(type);
     
     switch(type) {
         case WStype_DISCONNECTED:
             SERIAL_PRINTLN("WebSocket disconnected");
-            showWebSocketConnectionFailedAnimation();
+            heartbeatStop();
+            setCommandLinkState(COMMAND_LINK_DOWN);
+            if (fragmentedTextMessage) {
+                finishHomeAssistantMessage();
+                fragmentedTextMessage = false;
+            }
+            if (NUM_HA_ENDPOINTS > 1 && endpointConnected) {
+                failoverPending = true; // Not from inside webSocket.loop(); serviceWebSocket moves on
+            } else if (!failingOver) {
+                showWebSocketConnectionFailedAnimation();
+            }
+            endpointConnected = false;
             break;
         case WStype_CONNECTED:
             SERIAL_PRINTLN("WebSocket connected");
-            showWebSocketConnectedAnimation();
-            webSocket.sendTXT("{\"type\": \"auth\", \"access_token\": \"" + String(HA_API_PASSWORD) + "\"}");
+            webSocket.setReconnectInterval(WEBSOCKET_RECONNECT_INTERVAL_MS);
+            if (HA_USE_TLS && HA_CERT_FINGERPRINT[0] != '\0' && !webSocket.serverCertificateMatches(HA_CERT_FINGERPRINT)) {
+                SERIAL_PRINTLN("Server certificate does not match HA_CERT_FINGERPRINT, not sending the token");
+                certificateRejected = true;
+                showWebSocketConnectionFailedAnimation();
+                break;
+            }
+            endpointConnected = true;
+            endpointStartTime = millis(); // Now only auth_ok is waited for
+            bootMark(BOOT_WEBSOCKET_CONNECTED);
+            // A failover keeps the keys on screen, unless they are still hidden by the boot animation
+            if (!failingOver || overlayActive()) {
+                startOverlayAnimation(OVERLAY_WEBSOCKET_CONNECTED);
+            }
+            setCommandLinkState(COMMAND_LINK_CONNECTED);
+            queueCommand(COMMAND_AUTH);
             break;
         case WStype_TEXT:
             handleHomeAssistantMessage(payload, length);
@@ -35,10 +213,27 @@ void webSocketEvent(WStype_t type, uint8_t * payload, size_t length) {
         case WStype_ERROR:
             SERIAL_PRINTLN("WebSocket error occurred");
             break;
+        // Fragments are parsed as they arrive rather than queued during brightness updates,
+        // since the queue only holds whole messages
         case WStype_FRAGMENT_TEXT_START:
+            fragmentedTextMessage = true;
+            beginHomeAssistantMessage();
+            feedHomeAssistantMessage(payload, length);
+            break;
         case WStype_FRAGMENT_BIN_START:
+            fragmentedTextMessage = false;
+            break;
         case WStype_FRAGMENT:
+            if (fragmentedTextMessage) {
+                feedHomeAssistantMessage(payload, length);
+            }
+            break;
         case WStype_FRAGMENT_FIN:
+            if (fragmentedTextMessage) {
+                feedHomeAssistantMessage(payload, length);
+                finishHomeAssistantMessage();
+                fragmentedTextMessage = false;
+            }
             break;
         default:
             SERIAL_PRINTF("Unhandled WebSocket event type: %d\n", type);
@@ -47,20 +242,44 @@ void webSocketEvent(WStype_t type, uint8_t * payload, size_t length) {
 }
 
 
+// Returns room for size bytes after the newest payload, or nullptr if the ring has none in one piece
+static char* reserveQueueArena(size_t size) {
+    if (queuedMessageCount == 0) {
+        queueArenaHead = 0;
+        return size <= QUEUE_ARENA_SIZE ? queueArena : nullptr;
+    }
+    size_t oldest = queuedMessages[oldestQueuedMessage].payload - queueArena;
+    if (queueArenaHead > oldest) {
+        if (queueArenaHead + size <= QUEUE_ARENA_SIZE) {
+            return queueArena + queueArenaHead;
+        }
+        return size <= oldest ? queueArena : nullptr; // Wrap to the front
+    }
+    return queueArenaHead + size <= oldest ? queueArena + queueArenaHead : nullptr;
+}
+
 void queueWebSocketMessage(uint8_t* payload, size_t length) {
     if (xSemaphoreTake(queueMutex, portMAX_DELAY) == pdTRUE) {
         if (queuedMessageCount < MAX_QUEUED_MESSAGES) {
-            queuedMessages[queuedMessageCount].payload = (char*)malloc(length + 1);
-            if (queuedMessages[queuedMessageCount].payload) {
-                memcpy(queuedMessages[queuedMessageCount].payload, payload, length);
-                queuedMessages[queuedMessageCount].payload[length] = '\0';
-                queuedMessages[queuedMessageCount].length = length;
+            char* slot = reserveQueueArena(length + 1);
+            if (slot != nullptr) {
+                QueuedMessage& message = queuedMessages[(oldestQueuedMessage + queuedMessageCount) % MAX_QUEUED_MESSAGES];
+                message.payload = slot;
+                message.length = length;
+                memcpy(slot, payload, length);
+                slot[length] = '\0';
+                queueArenaHead = slot + length + 1 - queueArena;
                 queuedMessageCount++;
+                if (queuedMessageCount > queuedMessageHighWaterMark) {
+                    queuedMessageHighWaterMark = queuedMessageCount;
+                }
                 SERIAL_PRINTF("Queued message. Count: %d, Length: %d\n", queuedMessageCount, length);
             } else {
-                SERIAL_PRINTLN("Failed to allocate memory for queued message");
+                droppedMessageCount++;
+                SERIAL_PRINTLN("Queue arena is full, dropping message");
             }
         } else {
+            droppedMessageCount++;
             SERIAL_PRINTLN("Message queue is full, dropping message");
         }
         xSemaphoreGive(queueMutex);
@@ -68,19 +287,36 @@ void queueWebSocketMessage(uint8_t* payload, size_t length) {
 }
 
 
+// Replays queued messages oldest first. Each one is handled without queueMutex held, since the
+// handler queues the message again if an adjustment has just started; it stays in the ring until
+// it has been handled, so nothing is written over its payload meanwhile. Replayed frames were
+// already counted by metricsRecordFrame when they arrived.
 void processQueuedMessages() {
-    if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        int processedCount = 0;
-        unsigned long startTime = millis();
-        while (queuedMessageCount > 0 && processedCount < 5 && (millis() - startTime) < 1000) {  // Process up to 5 messages or for 500ms max
-            queuedMessageCount--;
-            webSocketEvent(WStype_TEXT, (uint8_t*)queuedMessages[queuedMessageCount].payload, queuedMessages[queuedMessageCount].length);
-            free(queuedMessages[queuedMessageCount].payload);
-            processedCount++;
-            SERIAL_PRINTF("Processed %d queued messages. Remaining: %d\n", processedCount, queuedMessageCount);
+    if (isStateStreamOpen()) {
+        return; // Replaying now would restart the parser in the middle of a fragmented message
+    }
+    int processedCount = 0;
+    unsigned long startTime = millis();
+    while (processedCount < 5 && (millis() - startTime) < 1000 && !isBrightnessUpdateInProgress) {  // Process up to 5 messages or for 1s max
+        if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+            SERIAL_PRINTLN("Failed to acquire queue mutex in processQueuedMessages");
+            return;
         }
+        bool empty = queuedMessageCount == 0;
+        QueuedMessage message = queuedMessages[oldestQueuedMessage];
         xSemaphoreGive(queueMutex);
-    } else {
-        SERIAL_PRINTLN("Failed to acquire queue mutex in processQueuedMessages");
+        if (empty) {
+            break;
+        }
+
+        handleHomeAssistantMessage((uint8_t*)message.payload, message.length);
+
+        if (xSemaphoreTake(queueMutex, portMAX_DELAY) == pdTRUE) {
+            oldestQueuedMessage = (oldestQueuedMessage + 1) % MAX_QUEUED_MESSAGES;
+            queuedMessageCount--;
+            xSemaphoreGive(queueMutex);
+        }
+        processedCount++;
+        SERIAL_PRINTF("Processed %d queued messages. Remaining: %d\n", processedCount, queuedMessageCount);
     }
 }
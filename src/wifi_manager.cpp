@@ -1,13 +1,49 @@
 #include "wifi_manager.h"
+#include "event_loop.h"
+#include "animations.h"
 
-bool connectToWiFi(unsigned long timeout) {
+// Only touched by the loop task; WiFi events just wake it
+static bool wifiConnected = false;
+static unsigned long connectAttemptTime = 0;
+
+static void wifiEvent(arduino_event_id_t event) {
+    notifyLoopTask();
+}
+
+void startWiFi() {
+    WiFi.onEvent(wifiEvent, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    WiFi.onEvent(wifiEvent, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
     WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-    unsigned long startAttemptTime = millis();
+    connectAttemptTime = millis();
+    startOverlayAnimation(OVERLAY_CONNECTING);
+}
 
-    while (WiFi.status() != WL_CONNECTED && millis() - startAttemptTime < timeout) {
-        delay(100);
-        SERIAL_PRINT(".");
+bool serviceWiFi() {
+    bool connected = WiFi.status() == WL_CONNECTED;
+    bool cameUp = connected && !wifiConnected;
+
+    if (cameUp) {
+        SERIAL_PRINTLN("Connected to WiFi");
+    } else if (!connected && wifiConnected) {
+        SERIAL_PRINTLN("WiFi connection lost");
+        connectAttemptTime = millis(); // The driver reconnects on its own
+    } else if (!connected && millis() - connectAttemptTime >= WIFI_CONNECT_TIMEOUT_MS) {
+        SERIAL_PRINTLN("Failed to connect to WiFi, retrying");
+        showConnectionFailedAnimation();
+        WiFi.disconnect();
+        WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+        connectAttemptTime = millis();
     }
 
-    return WiFi.status() == WL_CONNECTED;
+    wifiConnected = connected;
+    return cameUp;
+}
+
+// The timeout is the only thing on a schedule; everything else arrives as an event
+unsigned long wifiNextDue() {
+    if (wifiConnected) {
+        return ULONG_MAX;
+    }
+    unsigned long elapsed = millis() - connectAttemptTime;
+    return elapsed >= WIFI_CONNECT_TIMEOUT_MS ? 0 : WIFI_CONNECT_TIMEOUT_MS - elapsed;
 }
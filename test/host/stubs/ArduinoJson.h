@@ -0,0 +1,259 @@
+#ifndef HOST_ARDUINOJSON_H
+#define HOST_ARDUINOJSON_H
+
+// Just enough of ArduinoJson to build and serialize the documents homeassistant_handler.cpp
+// sends, so tests can read them or pass them to tools/mock_ha.py. Nodes and strings come from
+// one fixed pool that clear() empties, which is fine while the firmware has a single document,
+// and nothing is allocated.
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace host_json {
+
+enum Kind : uint8_t { KIND_NULL, KIND_OBJECT, KIND_ARRAY, KIND_STRING, KIND_INTEGER, KIND_REAL, KIND_BOOLEAN };
+
+struct Node {
+    const char* key;
+    Kind kind;
+    const char* text;
+    long long integer;
+    double real;
+    Node* first;
+    Node* last;
+    Node* next;
+};
+
+struct Pool {
+    Node nodes[256];
+    int nodesUsed;
+    char text[4096];
+    size_t textUsed;
+    bool overflowed;
+};
+
+inline Pool& pool() {
+    static Pool instance;
+    return instance;
+}
+
+inline const char* copyText(const char* text) {
+    Pool& p = pool();
+    size_t length = strlen(text) + 1;
+    if (p.textUsed + length > sizeof(p.text)) {
+        p.overflowed = true;
+        return "";
+    }
+    char* copy = p.text + p.textUsed;
+    memcpy(copy, text, length);
+    p.textUsed += length;
+    return copy;
+}
+
+inline Node* append(Node* parent, const char* key) {
+    Pool& p = pool();
+    if (p.nodesUsed == (int)(sizeof(p.nodes) / sizeof(p.nodes[0]))) {
+        p.overflowed = true;
+        return nullptr;
+    }
+    Node* node = &p.nodes[p.nodesUsed++];
+    memset(node, 0, sizeof(*node));
+    node->key = key ? copyText(key) : nullptr;
+    if (parent->last) {
+        parent->last->next = node;
+    } else {
+        parent->first = node;
+    }
+    parent->last = node;
+    return node;
+}
+
+struct Writer {
+    char* buffer;
+    size_t size;
+    size_t length;
+
+    void write(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(length < size ? buffer + length : nullptr, length < size ? size - length : 0,
+                                format, args);
+        va_end(args);
+        length += written > 0 ? written : 0;
+    }
+
+    void string(const char* text) {
+        write("\"");
+        for (const char* c = text; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                write("\\%c", *c);
+            } else {
+                write("%c", *c);
+            }
+        }
+        write("\"");
+    }
+
+    void value(const Node* node) {
+        switch (node->kind) {
+            case KIND_OBJECT:
+            case KIND_ARRAY:
+                write(node->kind == KIND_OBJECT ? "{" : "[");
+                for (const Node* child = node->first; child; child = child->next) {
+                    if (child != node->first) {
+                        write(",");
+                    }
+                    if (node->kind == KIND_OBJECT) {
+                        string(child->key);
+                        write(":");
+                    }
+                    value(child);
+                }
+                write(node->kind == KIND_OBJECT ? "}" : "]");
+                break;
+            case KIND_STRING:
+                string(node->text);
+                break;
+            case KIND_INTEGER:
+                write("%lld", node->integer);
+                break;
+            case KIND_REAL:
+                write("%.9g", node->real);
+                break;
+            case KIND_BOOLEAN:
+                write(node->integer ? "true" : "false");
+                break;
+            default:
+                write("null");
+                break;
+        }
+    }
+};
+
+} // namespace host_json
+
+struct JsonArray;
+struct JsonObject;
+
+struct JsonVariant {
+    host_json::Node* node;
+
+    JsonVariant(host_json::Node* node = nullptr) : node(node) {}
+
+    // Like ArduinoJson, indexing a null variant makes it an object and a missing key is added
+    JsonVariant operator[](const char* key) const {
+        if (!node) {
+            return JsonVariant();
+        }
+        if (node->kind == host_json::KIND_NULL) {
+            node->kind = host_json::KIND_OBJECT;
+        }
+        for (host_json::Node* child = node->first; child; child = child->next) {
+            if (strcmp(child->key, key) == 0) {
+                return JsonVariant(child);
+            }
+        }
+        return JsonVariant(host_json::append(node, key));
+    }
+
+    JsonVariant& operator=(const char* text) { return set(host_json::KIND_STRING, host_json::copyText(text), 0, 0); }
+    JsonVariant& operator=(bool flag) { return set(host_json::KIND_BOOLEAN, nullptr, flag, 0); }
+    JsonVariant& operator=(int number) { return set(host_json::KIND_INTEGER, nullptr, number, 0); }
+    JsonVariant& operator=(long number) { return set(host_json::KIND_INTEGER, nullptr, number, 0); }
+    JsonVariant& operator=(unsigned int number) { return set(host_json::KIND_INTEGER, nullptr, number, 0); }
+    JsonVariant& operator=(unsigned long number) { return set(host_json::KIND_INTEGER, nullptr, number, 0); }
+    JsonVariant& operator=(float number) { return set(host_json::KIND_REAL, nullptr, 0, number); }
+    JsonVariant& operator=(double number) { return set(host_json::KIND_REAL, nullptr, 0, number); }
+
+    JsonArray createNestedArray(const char* key = nullptr) const;
+    JsonObject createNestedObject(const char* key = nullptr) const;
+
+    template <typename T> bool add(const T& value) const {
+        host_json::Node* element = appendElement();
+        if (!element) {
+            return false;
+        }
+        JsonVariant variant(element);
+        variant = value;
+        return true;
+    }
+
+protected:
+    JsonVariant& set(host_json::Kind kind, const char* text, long long integer, double real) {
+        if (node) {
+            node->kind = kind;
+            node->text = text;
+            node->integer = integer;
+            node->real = real;
+        }
+        return *this;
+    }
+
+    host_json::Node* appendElement() const {
+        if (!node) {
+            return nullptr;
+        }
+        if (node->kind == host_json::KIND_NULL) {
+            node->kind = host_json::KIND_ARRAY;
+        }
+        return host_json::append(node, nullptr);
+    }
+
+    host_json::Node* nested(const char* key, host_json::Kind kind) const {
+        host_json::Node* child = key ? (*this)[key].node : appendElement();
+        if (child) {
+            child->kind = kind;
+        }
+        return child;
+    }
+};
+
+struct JsonArray : JsonVariant {
+    JsonArray(host_json::Node* node = nullptr) : JsonVariant(node) {}
+};
+
+struct JsonObject : JsonVariant {
+    JsonObject(host_json::Node* node = nullptr) : JsonVariant(node) {}
+};
+
+inline JsonArray JsonVariant::createNestedArray(const char* key) const {
+    return JsonArray(nested(key, host_json::KIND_ARRAY));
+}
+
+inline JsonObject JsonVariant::createNestedObject(const char* key) const {
+    return JsonObject(nested(key, host_json::KIND_OBJECT));
+}
+
+template <size_t N> struct StaticJsonDocument : JsonVariant {
+    host_json::Node root;
+
+    StaticJsonDocument() : JsonVariant(&root) { clear(); }
+
+    void clear() {
+        host_json::Pool& p = host_json::pool();
+        p.nodesUsed = 0;
+        p.textUsed = 0;
+        p.overflowed = false;
+        memset(&root, 0, sizeof(root));
+        root.kind = host_json::KIND_OBJECT;
+    }
+
+    bool overflowed() const { return host_json::pool().overflowed; }
+};
+
+template <typename T> size_t measureJson(const T& document) {
+    host_json::Writer writer = {nullptr, 0, 0};
+    writer.value(document.node);
+    return writer.length;
+}
+
+// Returns the bytes written, like ArduinoJson, so a truncated message comes back as size - 1
+template <typename T> size_t serializeJson(const T& document, char* buffer, size_t size) {
+    host_json::Writer writer = {buffer, size, 0};
+    writer.value(document.node);
+    return size > 0 && writer.length >= size ? size - 1 : writer.length;
+}
+
+#endif // HOST_ARDUINOJSON_H
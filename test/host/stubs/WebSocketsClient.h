@@ -0,0 +1,29 @@
+#ifndef HOST_WEBSOCKETSCLIENT_H
+#define HOST_WEBSOCKETSCLIENT_H
+
+#include <Arduino.h>
+
+typedef enum {
+    WStype_ERROR,
+    WStype_DISCONNECTED,
+    WStype_CONNECTED,
+    WStype_TEXT,
+    WStype_BIN,
+    WStype_FRAGMENT_TEXT_START,
+    WStype_FRAGMENT_BIN_START,
+    WStype_FRAGMENT,
+    WStype_FRAGMENT_FIN,
+    WStype_PING,
+    WStype_PONG
+} WStype_t;
+
+// Messages sent by the code under test go to hostSendText, defined by the test
+bool hostSendText(const char* payload, size_t length);
+
+class WebSocketsClient {
+public:
+    bool sendTXT(const char* payload) { return hostSendText(payload, strlen(payload)); }
+    bool sendTXT(char* payload, size_t length = 0) { return hostSendText(payload, length ? length : strlen(payload)); }
+};
+
+#endif // HOST_WEBSOCKETSCLIENT_H
@@ -0,0 +1,23 @@
+#ifndef HOST_DRIVER_RMT_H
+#define HOST_DRIVER_RMT_H
+
+// Types used by led_strip.h; the host tests never drive the strip. rmt_item32_t is laid out as in
+// ESP-IDF 4.4, so test_led_encoder can check the encoder against it.
+
+#include <stdint.h>
+
+typedef enum { RMT_CHANNEL_0, RMT_CHANNEL_1 } rmt_channel_t;
+
+typedef struct {
+    union {
+        struct {
+            uint32_t duration0 : 15;
+            uint32_t level0 : 1;
+            uint32_t duration1 : 15;
+            uint32_t level1 : 1;
+        };
+        uint32_t val;
+    };
+} rmt_item32_t;
+
+#endif // HOST_DRIVER_RMT_H
@@ -0,0 +1,10 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+#include <thread>
+
+// The tests run tasks as threads
+#define taskYIELD() std::this_thread::yield()
+
+#endif // HOST_FREERTOS_TASK_H
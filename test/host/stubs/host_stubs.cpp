@@ -0,0 +1,14 @@
+#include <Arduino.h>
+
+// Clock and serial port shared by every host test
+
+HostSerial Serial;
+unsigned long hostMillis = 1000;
+
+unsigned long millis() {
+    return hostMillis;
+}
+
+unsigned long micros() {
+    return hostMillis * 1000;
+}
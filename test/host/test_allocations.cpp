@@ -0,0 +1,157 @@
+#include "homeassistant_handler.h"
+#include "test.h"
+
+// Replays the traffic of tools/mock_ha.py through the message handlers and the outbound queue,
+// and checks that nothing touches the heap once the first round has warmed everything up.
+// malloc and friends are interposed here, which needs glibc.
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* pointer, size_t size);
+extern "C" void __libc_free(void* pointer);
+
+static bool countAllocations = false;
+static unsigned long allocations = 0;
+
+extern "C" void* malloc(size_t size) {
+    if (countAllocations) allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    if (countAllocations) allocations++;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size) {
+    if (countAllocations) allocations++;
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void free(void* pointer) {
+    if (countAllocations && pointer) allocations++;
+    __libc_free(pointer);
+}
+
+// What the rest of the firmware would provide
+unsigned long messageId = 1;
+volatile bool isBrightnessUpdateInProgress = false;
+SemaphoreHandle_t commandQueueMutex;
+DeckWebSocketsClient webSocket;
+
+static unsigned long sentMessages = 0;
+static unsigned long ledUpdates = 0;
+
+bool hostSendText(const char*, size_t) {
+    sentMessages++;
+    return true;
+}
+
+void updateLEDState(int, int, int, const EntityUpdate*) {
+    ledUpdates++;
+}
+
+void queueWebSocketMessage(uint8_t*, size_t) {}
+void webSocketAuthenticated() {}
+void bootMark(BootStage) {}
+void heartbeatStart() {}
+void heartbeatPong(unsigned long) {}
+void profilerRecordStateMessage(size_t, unsigned long) {}
+void metricsRecordParse(unsigned long) {}
+void notifyLoopTask() {}
+
+static char message[8192];
+
+// Feeds a message whole, or in fragments of fragmentSize bytes like a fragmented WebSocket frame
+static void receive(const char* text, size_t fragmentSize) {
+    size_t length = strlen(text);
+    if (fragmentSize == 0) {
+        memcpy(message, text, length + 1);
+        handleHomeAssistantMessage((uint8_t*)message, length);
+        return;
+    }
+    beginHomeAssistantMessage();
+    for (size_t offset = 0; offset < length; offset += fragmentSize) {
+        feedHomeAssistantMessage((const uint8_t*)text + offset, min(fragmentSize, length - offset));
+    }
+    finishHomeAssistantMessage();
+}
+
+static char snapshotMessage[8192];
+
+// A subscribe_entities snapshot of every mapped entity plus some that aren't, padded like
+// --attribute-padding so attributes the deck ignores have to be skipped
+static const char* snapshot(unsigned long id) {
+    int written = snprintf(snapshotMessage, sizeof(snapshotMessage), "{\"id\":%lu,\"type\":\"event\",\"event\":{\"a\":{", id);
+    char member[MAX_ENTITY_ID_LENGTH];
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        for (int m = 0; getMappingMember(i, m, member, sizeof(member)); m++) {
+            written += snprintf(snapshotMessage + written, sizeof(snapshotMessage) - written,
+                                "\"%s\":{\"s\":\"on\",\"a\":{\"friendly_name\":\"%s\",\"brightness\":%d,"
+                                "\"rgb_color\":[255,%d,0],\"volume_level\":0.45,\"padding\":\"%060d\"},"
+                                "\"c\":\"01H\",\"lc\":1700000000.1},",
+                                member, member, 10 + i, i, 0);
+        }
+    }
+    snprintf(snapshotMessage + written, sizeof(snapshotMessage) - written,
+             "\"sensor.unmapped\":{\"s\":\"21.5\",\"a\":{\"unit\":\"C\",\"list\":[[1,2],{\"x\":null}]}}}}}");
+    return snapshotMessage;
+}
+
+static const char* const traffic[] = {
+    "{\"type\":\"auth_required\",\"ha_version\":\"mock\"}",
+    "{\"type\":\"auth_ok\",\"ha_version\":\"mock\"}",
+    "{\"id\":2,\"type\":\"result\",\"success\":true,\"result\":null}",
+    "{\"id\":2,\"type\":\"event\",\"event\":{\"c\":{\"light.example1\":{\"+\":{\"a\":{\"brightness\":12}}}}}}",
+    "{\"id\":2,\"type\":\"event\",\"event\":{\"c\":{\"light.example2\":{\"+\":{\"s\":\"off\",\"a\":"
+    "{\"brightness\":null,\"rgb_color\":null}},\"-\":{\"a\":[\"effect\"]}}}}}",
+    "{\"id\":2,\"type\":\"event\",\"event\":{\"c\":{\"media_player.example1\":{\"+\":{\"a\":{\"volume_level\":0.3}}}}}}",
+    "{\"id\":3,\"type\":\"pong\"}",
+    "{\"id\":4,\"type\":\"result\",\"success\":true,\"result\":{\"context\":{\"id\":\"01H\"}}}",
+    "{\"id\":5,\"type\":\"event\",\"event\":{\"result\":\"1,255,0,0,200,-1;0,-1,-1,-1,-1,-1;;1,0,0,255,-1,115;\","
+    "\"listeners\":{\"all\":false,\"entities\":[\"light.example1\"],\"time\":false}}}",
+    "{\"id\":6,\"type\":\"result\",\"success\":false,\"error\":{\"code\":\"unauthorized\",\"message\":\"Unauthorized\"}}",
+};
+
+// One connection's worth of traffic, with the presses and level changes a user would make
+static void replay(size_t fragmentSize) {
+    setCommandLinkState(COMMAND_LINK_CONNECTED);
+    queueCommand(COMMAND_AUTH);
+    sendQueuedCommands();
+    for (size_t i = 0; i < sizeof(traffic) / sizeof(traffic[0]); i++) {
+        receive(traffic[i], fragmentSize);
+        if (i == 1) {
+            receive(snapshot(2), fragmentSize);
+        }
+        sendQueuedCommands();
+    }
+
+    toggleEntity(entityMappings[0].x, entityMappings[0].y);
+    performGestureAction(entityMappings[0].x, entityMappings[0].y, GESTURE_ACTION_TURN_OFF);
+    int mappings[] = {0, 1, 2};
+    int values[] = {40, 80, 120};
+    sendBrightnessOrVolumeUpdates(mappings, values, 3);
+    sendQueuedCommands();
+    setCommandLinkState(COMMAND_LINK_DOWN);
+}
+
+int main() {
+    initializeEntityStates();
+    CHECK(strlen(snapshot(2)) < sizeof(snapshotMessage) - 1);
+    replay(0); // Warm up, so anything allocated once at first use has happened
+
+    static const size_t fragmentSizes[] = {0, 1, 7, 64, 1000};
+    countAllocations = true;
+    for (size_t i = 0; i < sizeof(fragmentSizes) / sizeof(fragmentSizes[0]); i++) {
+        for (int round = 0; round < 20; round++) {
+            replay(fragmentSizes[i]);
+        }
+    }
+    countAllocations = false;
+
+    CHECK_EQUAL(0, allocations);
+    CHECK(ledUpdates > (unsigned long)NUM_MAPPINGS * 100); // The snapshot really was applied
+    CHECK(sentMessages > 0);
+    printf("%lu LED updates, %lu messages sent, %lu heap calls after warm-up\n", ledUpdates, sentMessages, allocations);
+    return testResult("test_allocations");
+}
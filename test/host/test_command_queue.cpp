@@ -0,0 +1,250 @@
+#include "command_queue.h"
+#include "test.h"
+#include <string>
+
+// Drives the outbound queue through link state changes and checks what is sent, in what order
+
+SemaphoreHandle_t commandQueueMutex;
+
+void notifyLoopTask() {}
+
+static std::string sent;
+static bool refuseSends = false;
+
+static void describe(const OutboundCommand& command) {
+    static const char* const kinds[] = {"auth", "subscribe", "toggle", "gesture", "level"};
+    char text[32];
+    if (command.mapping < 0) {
+        snprintf(text, sizeof(text), "%s ", kinds[command.kind]);
+    } else {
+        snprintf(text, sizeof(text), "%s %d=%d ", kinds[command.kind], command.mapping, command.value);
+    }
+    sent += text;
+}
+
+static bool send(const OutboundCommand& command) {
+    if (refuseSends) return false;
+    describe(command);
+    return true;
+}
+
+static int batchesSent = 0;
+
+static bool sendBatch(const OutboundCommand* commands, int count) {
+    if (refuseSends) return false;
+    sent += "[ ";
+    for (int i = 0; i < count; i++) {
+        describe(commands[i]);
+    }
+    sent += "] ";
+    batchesSent++;
+    return true;
+}
+
+// Sends whatever can go out and returns it
+static std::string drain(CommandBatchSender sendLevels = nullptr) {
+    sent.clear();
+    serviceCommandQueue(send, sendLevels);
+    return sent;
+}
+
+// Empties the queue between tests
+static void reset() {
+    setCommandLinkState(COMMAND_LINK_AUTHENTICATED);
+    hostMillis += OFFLINE_COMMAND_TTL_MS + 1;
+    drain();
+    commandsDropped = commandsExpired = commandsSuperseded = 0;
+}
+
+static void testPriority() {
+    reset();
+    setCommandLinkState(COMMAND_LINK_DOWN);
+    queueCommand(COMMAND_LEVEL, 3, 10);
+    queueCommand(COMMAND_TOGGLE, 1);
+    queueCommand(COMMAND_GESTURE, 2, 0, GESTURE_ACTION_TURN_ON);
+    queueCommand(COMMAND_LEVEL, 4, 7);
+    CHECK(drain() == ""); // Nothing goes out while the link is down
+
+    setCommandLinkState(COMMAND_LINK_CONNECTED);
+    queueCommand(COMMAND_AUTH);
+    CHECK(drain() == "auth "); // Only control messages before auth_ok
+
+    setCommandLinkState(COMMAND_LINK_AUTHENTICATED);
+    queueCommand(COMMAND_SUBSCRIBE);
+    CHECK(drain() == "subscribe toggle 1=0 gesture 2=0 level 3=10 level 4=7 ");
+    CHECK_EQUAL(0, queuedCommandCount());
+}
+
+static void testControlDroppedWithLink() {
+    reset();
+    setCommandLinkState(COMMAND_LINK_CONNECTED);
+    queueCommand(COMMAND_AUTH);
+    queueCommand(COMMAND_TOGGLE, 5);
+    setCommandLinkState(COMMAND_LINK_DOWN);
+    CHECK_EQUAL(1, queuedCommandCount()); // The next connection queues its own auth
+    setCommandLinkState(COMMAND_LINK_AUTHENTICATED);
+    CHECK(drain() == "toggle 5=0 ");
+}
+
+static void testSupersession() {
+    reset();
+    setCommandLinkState(COMMAND_LINK_DOWN);
+    queueCommand(COMMAND_LEVEL, 3, 10);
+    queueCommand(COMMAND_TOGGLE, 3);
+    queueCommand(COMMAND_LEVEL, 3, 20);
+    queueCommand(COMMAND_LEVEL, 3, 30);
+    CHECK_EQUAL(2, commandsSuperseded);
+    setCommandLinkState(COMMAND_LINK_AUTHENTICATED);
+    CHECK(drain() == "toggle 3=0 level 3=30 ");
+
+    // Toggles are never merged
+    queueCommand(COMMAND_TOGGLE, 3);
+    queueCommand(COMMAND_TOGGLE, 3);
+    CHECK(drain() == "toggle 3=0 toggle 3=0 ");
+}
+
+static void testExpiry() {
+    reset();
+    setCommandLinkState(COMMAND_LINK_DOWN);
+    queueCommand(COMMAND_TOGGLE, 5);
+    queueCommand(COMMAND_LEVEL, 6, 1);
+    hostMillis += OFFLINE_COMMAND_TTL_MS;
+    queueCommand(COMMAND_TOGGLE, 7);
+    setCommandLinkState(COMMAND_LINK_CONNECTED);
+    queueCommand(COMMAND_AUTH);
+    hostMillis += 1;
+    setCommandLinkState(COMMAND_LINK_AUTHENTICATED);
+    CHECK(drain() == "auth toggle 7=0 "); // Presses older than the TTL are not replayed
+    CHECK_EQUAL(2, commandsExpired);
+}
+
+static void testSendFailureKeepsCommand() {
+    reset();
+    queueCommand(COMMAND_TOGGLE, 1);
+    queueCommand(COMMAND_TOGGLE, 2);
+    refuseSends = true;
+    CHECK(drain() == "");
+    CHECK_EQUAL(2, queuedCommandCount());
+    refuseSends = false;
+    CHECK(drain() == "toggle 1=0 toggle 2=0 ");
+}
+
+static void testOverflow() {
+    reset();
+    setCommandLinkState(COMMAND_LINK_DOWN);
+    for (int i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        CHECK(queueCommand(COMMAND_LEVEL, i, i));
+    }
+    // A full queue makes room for a toggle by evicting the newest level
+    CHECK(queueCommand(COMMAND_TOGGLE, 30));
+    CHECK_EQUAL(1, commandsDropped);
+    CHECK_EQUAL(COMMAND_QUEUE_SIZE, queuedCommandCount());
+
+    // A new level replaces the newest level, and a superseding one takes no room
+    CHECK(queueCommand(COMMAND_LEVEL, 40, 1));
+    CHECK(queueCommand(COMMAND_LEVEL, 0, 99));
+    CHECK_EQUAL(2, commandsDropped);
+
+    for (int i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        CHECK(queueCommand(COMMAND_TOGGLE, 50 + i));
+    }
+    // Toggles evict every level; once only toggles are left, the newest toggle makes room
+    CHECK(!queueCommand(COMMAND_LEVEL, 60, 1));
+    CHECK(queueCommand(COMMAND_TOGGLE, 70));
+
+    setCommandLinkState(COMMAND_LINK_AUTHENTICATED);
+    std::string expected = "toggle 30=0 ";
+    for (int i = 0; i < COMMAND_QUEUE_SIZE - 2; i++) {
+        char text[24];
+        snprintf(text, sizeof(text), "toggle %d=0 ", 50 + i);
+        expected += text;
+    }
+    CHECK(drain() == expected + "toggle 70=0 ");
+}
+
+static void testBatchOrder() {
+    reset();
+    setCommandLinkState(COMMAND_LINK_DOWN);
+    int mappings[] = {4, 1, 7};
+    int values[] = {10, 20, 30};
+    CHECK_EQUAL(3, queueLevels(mappings, values, 3));
+    queueCommand(COMMAND_TOGGLE, 2);
+    queueCommand(COMMAND_LEVEL, 9, 5);
+    queueCommand(COMMAND_LEVEL, 4, 11); // Replaces the first level, and now counts as the newest
+    setCommandLinkState(COMMAND_LINK_AUTHENTICATED);
+    CHECK(drain(sendBatch) == "toggle 2=0 [ level 1=20 level 7=30 level 9=5 level 4=11 ] ");
+
+    // A single level goes out on its own
+    queueCommand(COMMAND_LEVEL, 5, 1);
+    CHECK(drain(sendBatch) == "level 5=1 ");
+
+    // Without a batch sender every level is sent separately, oldest first
+    CHECK_EQUAL(2, queueLevels(mappings, values, 2));
+    CHECK(drain() == "level 4=10 level 1=20 ");
+}
+
+static void testBatchLimit() {
+    reset();
+    setCommandLinkState(COMMAND_LINK_DOWN);
+    int mappings[COMMAND_BATCH_SIZE + 2];
+    int values[COMMAND_BATCH_SIZE + 2];
+    for (int i = 0; i < COMMAND_BATCH_SIZE + 2; i++) {
+        mappings[i] = COMMAND_BATCH_SIZE + 2 - i; // Sent in the order queued, not by key
+        values[i] = i;
+    }
+    CHECK_EQUAL(COMMAND_BATCH_SIZE + 2, queueLevels(mappings, values, COMMAND_BATCH_SIZE + 2));
+    setCommandLinkState(COMMAND_LINK_AUTHENTICATED);
+    batchesSent = 0;
+    std::string expected = "[ ";
+    for (int i = 0; i < COMMAND_BATCH_SIZE + 2; i++) {
+        char text[24];
+        snprintf(text, sizeof(text), "level %d=%d ", mappings[i], values[i]);
+        expected += text;
+        if (i == COMMAND_BATCH_SIZE - 1) expected += "] [ ";
+    }
+    CHECK(drain(sendBatch) == expected + "] ");
+    CHECK_EQUAL(2, batchesSent);
+}
+
+static void testBatchSendFailure() {
+    reset();
+    int mappings[] = {1, 2};
+    int values[] = {10, 20};
+    queueLevels(mappings, values, 2);
+    refuseSends = true;
+    CHECK(drain(sendBatch) == "");
+    refuseSends = false;
+    queueCommand(COMMAND_LEVEL, 2, 25); // Arrives while the batch waits for a retry
+    CHECK(drain(sendBatch) == "[ level 1=10 level 2=25 ] ");
+    CHECK_EQUAL(0, queuedCommandCount());
+}
+
+static void testRequeue() {
+    reset();
+    // The levels of a refused script come back, except where the key already has a newer one
+    queueCommand(COMMAND_LEVEL, 2, 99);
+    int mappings[] = {1, 2, 3};
+    int values[] = {10, 20, 30};
+    CHECK_EQUAL(3, requeueLevels(mappings, values, 3));
+    CHECK_EQUAL(0, commandsSuperseded);
+    CHECK(drain() == "level 2=99 level 1=10 level 3=30 ");
+
+    // queueLevels, unlike requeueLevels, replaces what is waiting
+    queueCommand(COMMAND_LEVEL, 2, 99);
+    CHECK_EQUAL(3, queueLevels(mappings, values, 3));
+    CHECK(drain() == "level 1=10 level 2=20 level 3=30 ");
+}
+
+int main() {
+    testPriority();
+    testControlDroppedWithLink();
+    testSupersession();
+    testExpiry();
+    testSendFailureKeepsCommand();
+    testOverflow();
+    testBatchOrder();
+    testBatchLimit();
+    testBatchSendFailure();
+    testRequeue();
+    return testResult("test_command_queue");
+}
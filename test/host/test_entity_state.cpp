@@ -0,0 +1,85 @@
+#include "entity_state.h"
+#include "test.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Stresses the per-key seqlocks with one writer and several readers on other threads, like the
+// loop task applying updates while the button and LED code read them. Every field of a written
+// state is derived from one counter, so a reader that copied half of one write and half of
+// another sees fields that disagree.
+
+#define STRESS_READERS 3
+#define STRESS_MILLISECONDS 1000
+
+static std::atomic<bool> running(true);
+
+static EntityState makeState(uint32_t n) {
+    EntityState state;
+    memset(&state, 0, sizeof(state));
+    state.is_on = n & 1;
+    state.r = n & 0xFF;
+    state.g = (n >> 8) & 0xFF;
+    state.b = (n >> 16) & 0xFF;
+    state.brightness = (n >> 24) & 0xFF;
+    state.volume = (float)(n & 0xFFFF);
+    state.members_on = n;
+    return state;
+}
+
+static bool consistent(const EntityState& state) {
+    EntityState expected = makeState(state.members_on);
+    return state.is_on == expected.is_on && state.r == expected.r && state.g == expected.g && state.b == expected.b &&
+           state.brightness == expected.brightness && state.volume == expected.volume;
+}
+
+int main() {
+    initializeEntityStates();
+    for (int page = 0; page < NUM_PAGES; page++) {
+        for (int y = 0; y < ROWS; y++) {
+            for (int x = 0; x < COLS; x++) {
+                writeEntityState(page, x, y, makeState(0));
+            }
+        }
+    }
+
+    // The writer keeps rewriting two keys, so readers of those keys race it constantly
+    std::thread writer([] {
+        uint32_t n = 1;
+        while (running) {
+            writeEntityState(0, 2, 1, makeState(n++));
+            writeEntityState(NUM_PAGES - 1, COLS - 1, ROWS - 1, makeState(n++));
+        }
+    });
+
+    std::atomic<unsigned long> reads(0), torn(0), stale(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < STRESS_READERS; r++) {
+        readers.emplace_back([&] {
+            uint32_t lastSeen = 0;
+            while (running) {
+                EntityState state = readEntityState(0, 2, 1);
+                EntityState other = readEntityState(NUM_PAGES - 1, COLS - 1, ROWS - 1);
+                if (!consistent(state) || !consistent(other)) torn++;
+                if (state.members_on < lastSeen) stale++; // A reader never goes back to an older write
+                lastSeen = state.members_on;
+                reads += 2;
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(STRESS_MILLISECONDS));
+    running = false;
+    writer.join();
+    for (size_t r = 0; r < readers.size(); r++) {
+        readers[r].join();
+    }
+
+    printf("%lu reads, %lu torn, %lu out of order\n", reads.load(), torn.load(), stale.load());
+    CHECK(reads > 0);
+    CHECK_EQUAL(0, torn);
+    CHECK_EQUAL(0, stale);
+    CHECK(consistent(readEntityState(0, 2, 1)));
+    return testResult("test_entity_state");
+}
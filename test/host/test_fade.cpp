@@ -0,0 +1,92 @@
+#include "fade.h"
+#include "test.h"
+#include <chrono>
+
+// Steps fades through fadeTick at chosen times and checks where each pixel is and when it ends
+
+static uint32_t written[NUM_LEDS];
+static int writes = 0;
+
+static void record(int index, uint32_t color) {
+    written[index] = color;
+    writes++;
+}
+
+static uint8_t red(uint32_t color) {
+    return color >> 16;
+}
+
+static void testFullFade() {
+    fadeCancelAll();
+    fadeSetTarget(0, 0x000000, 0xFFFFFF, 1000);
+    CHECK(fadeActive());
+
+    CHECK(fadeTick(1000, record));
+    CHECK_EQUAL(0x000000, written[0]);
+
+    // Both easings are halfway at the midpoint
+    fadeTick(1000 + LED_FADE_MS / 2, record);
+    CHECK(red(written[0]) >= 127 && red(written[0]) <= 129);
+
+    // Never steps backwards on the way up
+    uint8_t previous = 0;
+    for (uint32_t now = 1000; now < 1000 + LED_FADE_MS; now += 5) {
+        fadeTick(now, record);
+        CHECK(red(written[0]) >= previous);
+        previous = red(written[0]);
+    }
+    CHECK(fadeActive());
+
+    fadeTick(1000 + LED_FADE_MS, record);
+    CHECK_EQUAL(0xFFFFFF, written[0]);
+    CHECK(!fadeActive());
+    CHECK(!fadeTick(1001 + LED_FADE_MS, record));
+}
+
+static void testRetarget() {
+    fadeCancelAll();
+    fadeSetTarget(0, 0x000000, 0xFFFFFF, 0);
+    uint32_t retargetTime = LED_FADE_MS * 4 / 5;
+    fadeTick(retargetTime, record);
+    uint32_t shown = written[0];
+
+    // The new fade starts from the colour on the strip, not from the one the caller passes
+    fadeSetTarget(0, 0x123456, 0x000000, retargetTime);
+    fadeTick(retargetTime, record);
+    CHECK_EQUAL(shown, written[0]);
+
+    // and takes the full duration from the retarget, not what was left of the first fade
+    fadeTick(LED_FADE_MS, record);
+    CHECK(fadeActive());
+    CHECK(red(written[0]) > 0);
+    fadeTick(retargetTime + LED_FADE_MS - 1, record);
+    CHECK(fadeActive());
+    fadeTick(retargetTime + LED_FADE_MS, record);
+    CHECK_EQUAL(0x000000, written[0]);
+    CHECK(!fadeActive());
+}
+
+// A frame with every key fading, which is what the loop task pays each LED_FRAME_INTERVAL_MS
+static void testFrameCost() {
+    const int frames = 100000;
+    fadeCancelAll();
+    for (int i = 0; i < NUM_LEDS; i++) {
+        fadeSetTarget(i, 0x000000, 0xFF8040, 0);
+    }
+    writes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        fadeTick(frame % LED_FADE_MS, record);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    CHECK_EQUAL(frames * NUM_LEDS, writes);
+    printf("%d pixels, %lld ns per frame on the host\n", NUM_LEDS, (long long)elapsed.count() / frames);
+}
+
+int main() {
+    CHECK(LED_FADE_MS > 0);
+    testFullFade();
+    testRetarget();
+    testFrameCost();
+    return testResult("test_fade");
+}
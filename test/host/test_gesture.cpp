@@ -0,0 +1,162 @@
+#include "gesture.h"
+#include "test.h"
+
+// Replays press/release timelines through the gesture engine, one scan every 10ms like the button task
+
+struct Timeline {
+    GestureKey key;
+    unsigned long now;
+    uint8_t events;
+};
+
+static bool idle(const GestureKey& key) {
+    return key.state == GESTURE_STATE_IDLE;
+}
+
+static void begin(Timeline& t, bool multiTap) {
+    gestureInit(t.key, multiTap);
+    t.now = 1000;
+    t.events = 0;
+}
+
+// Scans with the key held or released for `duration` ms, collecting every event reported
+static void scan(Timeline& t, bool pressed, unsigned long duration) {
+    t.events = 0;
+    for (unsigned long elapsed = 0; elapsed < duration; elapsed += 10) {
+        t.events |= gestureUpdate(t.key, pressed, t.now);
+        t.now += 10;
+    }
+}
+
+static void testTap() {
+    Timeline t;
+    begin(t, false);
+    scan(t, true, 100);
+    CHECK_EQUAL(0, t.events);
+    scan(t, false, 10);
+    CHECK_EQUAL(GESTURE_TAP, t.events); // Reported on release, without waiting for a second tap
+    scan(t, false, 10);
+    CHECK(idle(t.key));
+}
+
+static void testDoubleTap() {
+    Timeline t;
+    begin(t, true);
+    scan(t, true, 80);
+    scan(t, false, 100);
+    CHECK_EQUAL(GESTURE_TAP, t.events);
+    scan(t, true, 10);
+    CHECK_EQUAL(GESTURE_DOUBLE_TAP, t.events);
+    scan(t, true, 60);
+    scan(t, false, 10);
+    CHECK_EQUAL(0, t.events);
+    CHECK(idle(t.key));
+}
+
+static void testSecondPressAfterWindow() {
+    Timeline t;
+    begin(t, true);
+    scan(t, true, 80);
+    scan(t, false, DOUBLE_TAP_WINDOW + 20);
+    CHECK_EQUAL(GESTURE_TAP, t.events);
+    CHECK(idle(t.key));
+    scan(t, true, 80);
+    scan(t, false, 10);
+    CHECK_EQUAL(GESTURE_TAP, t.events); // A fresh tap, not a double tap
+}
+
+static void testSecondPressWithoutDoubleTapBinding() {
+    Timeline t;
+    begin(t, false);
+    scan(t, true, 80);
+    scan(t, false, 50);
+    scan(t, true, 80);
+    scan(t, false, 10);
+    CHECK_EQUAL(GESTURE_TAP, t.events);
+}
+
+static void testHoldAndLongPress() {
+    Timeline t;
+    begin(t, false);
+    scan(t, true, LONG_PRESS_TIME - 10);
+    CHECK_EQUAL(0, t.events);
+    scan(t, true, 20);
+    CHECK_EQUAL(GESTURE_HOLD, t.events); // While the key is still down
+    scan(t, true, 500);
+    CHECK_EQUAL(0, t.events);            // Only once
+    scan(t, false, 10);
+    CHECK_EQUAL(GESTURE_LONG_PRESS, t.events);
+    CHECK(idle(t.key));
+}
+
+static void testHoldAndReleaseInOneScan() {
+    GestureKey key;
+    gestureInit(key, false);
+    gestureUpdate(key, true, 1000);
+    CHECK_EQUAL(GESTURE_HOLD | GESTURE_LONG_PRESS, gestureUpdate(key, false, 1000 + LONG_PRESS_TIME + 50));
+    CHECK(idle(key));
+}
+
+static void testHeldDoubleTap() {
+    Timeline t;
+    begin(t, true);
+    scan(t, true, 80);
+    scan(t, false, 80);
+    scan(t, true, LONG_PRESS_TIME + 100);
+    CHECK_EQUAL(GESTURE_DOUBLE_TAP, t.events); // No hold after a double tap
+    scan(t, false, 10);
+    CHECK_EQUAL(0, t.events);
+    CHECK(idle(t.key));
+}
+
+static void testCancel() {
+    Timeline t;
+    begin(t, false);
+    scan(t, true, 200);
+    gestureCancel(t.key);
+    scan(t, true, LONG_PRESS_TIME);
+    CHECK_EQUAL(0, t.events);
+    scan(t, false, 10);
+    CHECK_EQUAL(0, t.events);
+    CHECK(idle(t.key));
+
+    // A waiting tap is dropped without a double tap
+    begin(t, true);
+    scan(t, true, 50);
+    scan(t, false, 50);
+    gestureCancel(t.key);
+    CHECK(idle(t.key));
+    scan(t, true, 10);
+    CHECK_EQUAL(0, t.events);
+
+    // A key held past its long press, like the child lock keys, doesn't report it on release
+    begin(t, false);
+    scan(t, true, LONG_PRESS_TIME + 100);
+    CHECK_EQUAL(GESTURE_HOLD, t.events);
+    gestureCancel(t.key);
+    scan(t, false, 10);
+    CHECK_EQUAL(0, t.events);
+    CHECK(idle(t.key));
+}
+
+static void testMillisRollover() {
+    GestureKey key;
+    gestureInit(key, true);
+    unsigned long start = (unsigned long)-50;
+    gestureUpdate(key, true, start);
+    CHECK_EQUAL(GESTURE_TAP, gestureUpdate(key, false, start + 80));
+    CHECK_EQUAL(GESTURE_DOUBLE_TAP, gestureUpdate(key, true, start + 160));
+}
+
+int main() {
+    testTap();
+    testDoubleTap();
+    testSecondPressAfterWindow();
+    testSecondPressWithoutDoubleTapBinding();
+    testHoldAndLongPress();
+    testHoldAndReleaseInOneScan();
+    testHeldDoubleTap();
+    testCancel();
+    testMillisRollover();
+    return testResult("test_gesture");
+}
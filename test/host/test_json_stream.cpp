@@ -0,0 +1,138 @@
+#include "json_stream.h"
+#include "test.h"
+#include <string>
+
+// Feeds documents to the tokenizer whole, one byte at a time and in chunks of other sizes, and
+// checks that every split reports the same tokens
+
+static std::string tokens;
+
+static void record(JsonStreamToken token, const char* text, size_t length, int depth) {
+    static const char* const names[] = {"{", "}", "[", "]", "key", "part", "string", "number", "true", "false", "null"};
+    char line[32];
+    snprintf(line, sizeof(line), "%d %s ", depth, names[token]);
+    tokens += line;
+    tokens.append(text, length);
+    tokens += '\n';
+}
+
+// Returns jsonStreamFinish's result, or false as soon as a feed fails
+static bool parse(const std::string& document, size_t chunkSize) {
+    JsonStream stream;
+    jsonStreamInit(stream, record);
+    tokens.clear();
+    for (size_t offset = 0; offset < document.size(); offset += chunkSize) {
+        if (!jsonStreamFeed(stream, document.data() + offset, std::min(chunkSize, document.size() - offset))) {
+            return false;
+        }
+    }
+    return jsonStreamFinish(stream);
+}
+
+// Parses the document whole and checks every other split matches; returns the tokens
+static std::string parseEverySplit(const std::string& document) {
+    CHECK(parse(document, document.size()));
+    std::string whole = tokens;
+    static const size_t chunkSizes[] = {1, 2, 3, 7, 63, 64, 65};
+    for (size_t i = 0; i < sizeof(chunkSizes) / sizeof(chunkSizes[0]); i++) {
+        CHECK(parse(document, chunkSizes[i]));
+        CHECK(tokens == whole);
+    }
+    return whole;
+}
+
+static void testTokensAndDepth() {
+    std::string expected =
+        "0 { \n"
+        "1 key type\n"
+        "1 string event\n"
+        "1 key id\n"
+        "1 number -12.5e3\n"
+        "1 key event\n"
+        "1 { \n"
+        "2 key list\n"
+        "2 [ \n"
+        "3 true true\n"
+        "3 false false\n"
+        "3 null null\n"
+        "3 { \n"
+        "3 } \n"
+        "3 [ \n"
+        "3 ] \n"
+        "2 ] \n"
+        "1 } \n"
+        "0 } \n";
+    CHECK(parseEverySplit("{\"type\":\"event\", \"id\" : -12.5e3,\n\t\"event\":{\"list\":[true,false,null,{},[]]}}") ==
+          expected);
+}
+
+static void testEscapes() {
+    CHECK(parseEverySplit("[\"a\\\"b\\\\c\\/d\\n\\u00e9\\u20ac\\u0041\"]") ==
+          "0 [ \n1 string a\"b\\c/d\n\xc3\xa9\xe2\x82\xac" "A\n0 ] \n");
+}
+
+static void testLongStrings() {
+    std::string value(200, 'v');
+    std::string parsed = parseEverySplit("{\"k\":\"" + value + "\"}");
+    // Parts of JSON_STREAM_TOKEN_SIZE - 1 characters, then the rest
+    std::string part(JSON_STREAM_TOKEN_SIZE - 1, 'v');
+    std::string rest(200 - 3 * (JSON_STREAM_TOKEN_SIZE - 1), 'v');
+    CHECK(parsed == "0 { \n1 key k\n1 part " + part + "\n1 part " + part + "\n1 part " + part + "\n1 string " + rest +
+                    "\n0 } \n");
+
+    // A key that doesn't fit is reported empty, and its value still arrives
+    std::string key(JSON_STREAM_TOKEN_SIZE, 'k');
+    CHECK(parseEverySplit("{\"" + key + "\":1,\"b\":2}") == "0 { \n1 key \n1 number 1\n1 key b\n1 number 2\n0 } \n");
+}
+
+static void testDepthLimit() {
+    std::string deepest = std::string(JSON_STREAM_MAX_DEPTH, '[') + std::string(JSON_STREAM_MAX_DEPTH, ']');
+    CHECK(parse(deepest, 1));
+    std::string tooDeep = std::string(JSON_STREAM_MAX_DEPTH + 1, '[') + std::string(JSON_STREAM_MAX_DEPTH + 1, ']');
+    CHECK(!parse(tooDeep, 1));
+    CHECK(!parse(tooDeep, tooDeep.size()));
+
+    // Objects and arrays alternating, so each level's container type is tracked
+    std::string mixed;
+    for (int i = 0; i < JSON_STREAM_MAX_DEPTH / 2; i++) mixed += "{\"a\":[";
+    for (int i = 0; i < JSON_STREAM_MAX_DEPTH / 2; i++) mixed += "]}";
+    CHECK(parse(mixed, 1));
+}
+
+static void testTopLevelScalar() {
+    CHECK(parse("42", 1));
+    CHECK(tokens == "0 number 42\n");
+    CHECK(parse("true", 4));
+    CHECK(tokens == "0 true true\n");
+}
+
+static void testMalformed() {
+    static const char* const documents[] = {
+        "{\"a\" 1}",   // Missing colon
+        "{\"a\":1",    // Unclosed
+        "[1 2]",       // Missing comma
+        "{\"a\":tru}", // Unknown literal
+        "[}",          // Mismatched close
+        "{\"a\":1}}",  // Closed twice
+        "{1:2}",       // Key that isn't a string
+        "[\"\\x\"]",   // Bad escape
+        "[\"\\u12g4\"]",
+        "\"open",
+    };
+    for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); i++) {
+        std::string document = documents[i];
+        CHECK(!parse(document, 1));
+        CHECK(!parse(document, document.size()));
+    }
+    CHECK(!parse("[" + std::string(JSON_STREAM_TOKEN_SIZE, '1') + "]", 5)); // Number too long
+}
+
+int main() {
+    testTokensAndDepth();
+    testEscapes();
+    testLongStrings();
+    testDepthLimit();
+    testTopLevelScalar();
+    testMalformed();
+    return testResult("test_json_stream");
+}
@@ -0,0 +1,88 @@
+#include "led_encoder.h"
+#include "test.h"
+#include <driver/rmt.h>
+#include <string.h>
+
+// Decodes encoded frames back into bytes the way a WS2812 reads them, by the length of each high pulse
+
+static void testItemLayout() {
+    // Must match rmt_item32_t, since the items are handed to the RMT driver as those
+    rmt_item32_t item;
+    item.val = ledItem(LED_T1H_TICKS, true, LED_RESET_TICKS, false);
+    CHECK_EQUAL(LED_T1H_TICKS, item.duration0);
+    CHECK_EQUAL(1, item.level0);
+    CHECK_EQUAL(LED_RESET_TICKS, item.duration1);
+    CHECK_EQUAL(0, item.level1);
+    item.val = ledItem(0x7FFF, false, 1, true);
+    CHECK_EQUAL(0x7FFF, item.duration0);
+    CHECK_EQUAL(0, item.level0);
+    CHECK_EQUAL(1, item.duration1);
+    CHECK_EQUAL(1, item.level1);
+}
+
+// Returns the decoded byte count, or -1 if an item isn't a valid bit
+static int decode(const uint32_t* items, size_t count, uint8_t* bytes) {
+    int decoded = 0;
+    for (size_t i = 0; i + 8 <= count; i += 8) {
+        uint8_t value = 0;
+        for (size_t bit = 0; bit < 8; bit++) {
+            rmt_item32_t item;
+            item.val = items[i + bit];
+            if (!item.level0 || item.level1) return -1;
+            bool one = item.duration0 == LED_T1H_TICKS && item.duration1 == LED_T1L_TICKS;
+            bool zero = item.duration0 == LED_T0H_TICKS && item.duration1 == LED_T0L_TICKS;
+            if (!one && !zero) return -1;
+            value = (value << 1) | one;
+        }
+        bytes[decoded++] = value;
+    }
+    return decoded;
+}
+
+static void testRoundTrip() {
+    static const uint16_t count = 24;
+    uint8_t grb[count * 3];
+    for (int i = 0; i < count * 3; i++) {
+        grb[i] = (uint8_t)(i * 37 + 1);
+    }
+    grb[0] = 0x00;
+    grb[1] = 0xFF;
+    grb[2] = 0x80; // Most significant bit first
+
+    static uint32_t items[LED_FRAME_ITEMS(count)];
+    size_t written = encodeLedFrame(grb, count, items);
+    CHECK_EQUAL(LED_FRAME_ITEMS(count), written);
+
+    uint8_t decoded[count * 3];
+    CHECK_EQUAL(count * 3, decode(items, written - 1, decoded));
+    CHECK(memcmp(grb, decoded, sizeof(grb)) == 0);
+
+    rmt_item32_t first;
+    first.val = items[16];
+    CHECK_EQUAL(LED_T1H_TICKS, first.duration0); // 0x80: a one, then seven zeros
+
+    // Every bit lasts 1.25us, within WS2812 tolerance
+    CHECK_EQUAL(50, LED_T0H_TICKS + LED_T0L_TICKS);
+    CHECK_EQUAL(50, LED_T1H_TICKS + LED_T1L_TICKS);
+}
+
+static void testResetItem() {
+    uint8_t grb[3] = {1, 2, 3};
+    uint32_t items[LED_FRAME_ITEMS(1)];
+    CHECK_EQUAL(25, encodeLedFrame(grb, 1, items));
+    rmt_item32_t reset;
+    reset.val = items[24];
+    CHECK_EQUAL(0, reset.level0);
+    CHECK_EQUAL(0, reset.level1);
+    CHECK(reset.duration0 * 25 >= 280 * 1000); // At least 280us low latches the frame
+    CHECK(reset.duration1 != 0);              // A zero duration would end the transmission early
+
+    CHECK_EQUAL(1, encodeLedFrame(grb, 0, items));
+}
+
+int main() {
+    testItemLayout();
+    testRoundTrip();
+    testResetItem();
+    return testResult("test_led_encoder");
+}
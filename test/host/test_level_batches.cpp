@@ -0,0 +1,82 @@
+#include "homeassistant_handler.h"
+#include "test.h"
+
+// Sends level batches through the message handlers and answers them the way Home Assistant
+// does, to check that a refused execute_script still gets every level to Home Assistant
+
+unsigned long messageId = 1;
+volatile bool isBrightnessUpdateInProgress = false;
+SemaphoreHandle_t commandQueueMutex;
+DeckWebSocketsClient webSocket;
+
+static int sentMessages = 0;
+
+bool hostSendText(const char*, size_t) {
+    sentMessages++;
+    return true;
+}
+
+void updateLEDState(int, int, int, const EntityUpdate*) {}
+void queueWebSocketMessage(uint8_t*, size_t) {}
+void webSocketAuthenticated() {}
+void bootMark(BootStage) {}
+void heartbeatStart() {}
+void heartbeatPong(unsigned long) {}
+void profilerRecordStateMessage(size_t, unsigned long) {}
+void metricsRecordParse(unsigned long) {}
+void notifyLoopTask() {}
+
+static void receive(const char* text) {
+    static char message[256];
+    strncpy(message, text, sizeof(message) - 1);
+    handleHomeAssistantMessage((uint8_t*)message, strlen(message));
+}
+
+static void answer(unsigned long id, bool success) {
+    char message[128];
+    snprintf(message, sizeof(message), "{\"id\":%lu,\"type\":\"result\",\"success\":%s}", id, success ? "true" : "false");
+    receive(message);
+}
+
+// Returns how many messages went out
+static int send() {
+    sentMessages = 0;
+    sendQueuedCommands();
+    return sentMessages;
+}
+
+int main() {
+    CHECK(BATCH_LEVEL_UPDATES);
+    initializeEntityStates();
+    setCommandLinkState(COMMAND_LINK_CONNECTED);
+    receive("{\"type\":\"auth_ok\",\"ha_version\":\"mock\"}");
+    CHECK_EQUAL(1, send()); // The subscription
+
+    int mappings[] = {0, 1, 2};
+    int values[] = {40, 80, 120};
+
+    // An accepted script is sent once
+    sendBrightnessOrVolumeUpdates(mappings, values, 3);
+    unsigned long batchId = messageId;
+    CHECK_EQUAL(1, send());
+    answer(batchId, true);
+    CHECK_EQUAL(0, send());
+
+    // While a script's result is pending, further levels go one call each
+    sendBrightnessOrVolumeUpdates(mappings, values, 3);
+    batchId = messageId;
+    CHECK_EQUAL(1, send());
+    sendBrightnessOrVolumeUpdates(mappings, values, 2);
+    CHECK_EQUAL(2, send());
+    answer(batchId + 1, false); // A call_service result doesn't touch the script
+    CHECK_EQUAL(0, send());
+
+    // A refused script is sent again one call per level, and later batches skip the script
+    answer(batchId, false);
+    CHECK_EQUAL(3, send());
+    sendBrightnessOrVolumeUpdates(mappings, values, 3);
+    CHECK_EQUAL(3, send());
+    CHECK_EQUAL(0, queuedCommandCount());
+
+    return testResult("test_level_batches");
+}
@@ -0,0 +1,287 @@
+#include "homeassistant_handler.h"
+#include "test.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs the message handlers, state stream and outbound queue against tools/mock_ha.py over a
+// real WebSocket: the snapshot, a toggle, a level batch and a toggle made while offline must all
+// come back from the mock as state updates. Needs python3; the test is skipped without it.
+
+extern char** environ;
+
+unsigned long messageId = 1;
+volatile bool isBrightnessUpdateInProgress = false;
+SemaphoreHandle_t commandQueueMutex;
+DeckWebSocketsClient webSocket;
+
+void queueWebSocketMessage(uint8_t*, size_t) {}
+void webSocketAuthenticated() {}
+void bootMark(BootStage) {}
+void heartbeatStart() {}
+void heartbeatPong(unsigned long) {}
+void profilerRecordStateMessage(size_t, unsigned long) {}
+void metricsRecordParse(unsigned long) {}
+void notifyLoopTask() {}
+
+#define MOCK_WAIT_MS 5000
+
+static int mockSocket = -1;
+static int sentMessages = 0;
+static bool mappingUpdated[NUM_MAPPINGS];
+static bool mappingOn[NUM_MAPPINGS];
+static int mappingBrightness[NUM_MAPPINGS];
+
+void updateLEDState(int page, int x, int y, const EntityUpdate* update) {
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        if (entityMappings[i].page == page && entityMappings[i].x == x && entityMappings[i].y == y && update) {
+            mappingUpdated[i] = true;
+            if (update->has_state) {
+                mappingOn[i] = update->is_on;
+            }
+            if (update->has_brightness) {
+                mappingBrightness[i] = update->brightness;
+            }
+        }
+    }
+}
+
+static bool sendAll(const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = send(mockSocket, data, length, MSG_NOSIGNAL);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+static bool receiveAll(uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(mockSocket, data, length, 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+// Client frames are masked, as the protocol requires
+bool hostSendText(const char* payload, size_t length) {
+    if (mockSocket < 0 || length > 0xFFFF) {
+        return false;
+    }
+    static uint8_t frame[4 + 4 + 0x10000];
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    size_t header = 0;
+    frame[header++] = 0x81;
+    if (length < 126) {
+        frame[header++] = 0x80 | length;
+    } else {
+        frame[header++] = 0x80 | 126;
+        frame[header++] = length >> 8;
+        frame[header++] = length & 0xFF;
+    }
+    memcpy(frame + header, mask, sizeof(mask));
+    header += sizeof(mask);
+    for (size_t i = 0; i < length; i++) {
+        frame[header + i] = payload[i] ^ mask[i % 4];
+    }
+    if (!sendAll(frame, header + length)) {
+        return false;
+    }
+    sentMessages++;
+    return true;
+}
+
+static int freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(fd, (sockaddr*)&address, sizeof(address));
+    getsockname(fd, (sockaddr*)&address, &length);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+static pid_t startMock(int port) {
+    char portText[8];
+    snprintf(portText, sizeof(portText), "%d", port);
+    const char* argv[] = {"python3", "../../tools/mock_ha.py", "--host", "127.0.0.1", "--port", portText,
+                          "--rate", "0", "--report-interval", "3600", nullptr};
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid = -1;
+    int result = posix_spawnp(&pid, "python3", &actions, nullptr, (char* const*)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    return result == 0 ? pid : -1;
+}
+
+// Connects and upgrades to a WebSocket, retrying while the mock starts up
+static bool connectMock(int port) {
+    for (int attempt = 0; attempt < MOCK_WAIT_MS / 50; attempt++) {
+        mockSocket = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(mockSocket, (sockaddr*)&address, sizeof(address)) == 0) {
+            break;
+        }
+        close(mockSocket);
+        mockSocket = -1;
+        usleep(50 * 1000);
+    }
+    if (mockSocket < 0) {
+        return false;
+    }
+
+    char request[256];
+    int length = snprintf(request, sizeof(request),
+                          "GET /api/websocket HTTP/1.1\r\nHost: 127.0.0.1:%d\r\nUpgrade: websocket\r\n"
+                          "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                          "Sec-WebSocket-Version: 13\r\n\r\n", port);
+    if (!sendAll((const uint8_t*)request, length)) {
+        return false;
+    }
+
+    char response[512];
+    size_t received = 0;
+    while (received < sizeof(response) - 1) {
+        if (!receiveAll((uint8_t*)response + received, 1)) {
+            return false;
+        }
+        received++;
+        response[received] = '\0';
+        if (strstr(response, "\r\n\r\n")) {
+            return strstr(response, " 101 ") != nullptr;
+        }
+    }
+    return false;
+}
+
+static void disconnectMock() {
+    close(mockSocket);
+    mockSocket = -1;
+    setCommandLinkState(COMMAND_LINK_DOWN);
+}
+
+// Server frames are unmasked; the mock only fragments with --fragment-size, which isn't used
+static bool receiveMessage() {
+    static uint8_t message[32 * 1024];
+    uint8_t head[2];
+    if (!receiveAll(head, sizeof(head))) {
+        return false;
+    }
+    size_t length = head[1] & 0x7F;
+    if (length == 126) {
+        uint8_t extended[2];
+        if (!receiveAll(extended, sizeof(extended))) {
+            return false;
+        }
+        length = extended[0] << 8 | extended[1];
+    } else if (length == 127) {
+        return false;
+    }
+    if (length >= sizeof(message) || !receiveAll(message, length)) {
+        return false;
+    }
+    message[length] = '\0';
+    if ((head[0] & 0x0F) == 0x1) {
+        handleHomeAssistantMessage(message, length);
+    }
+    return true;
+}
+
+// Handles messages and sends what they queue, like the loop task, until done() or the timeout
+static bool pump(bool (*done)()) {
+    for (int waited = 0; waited < MOCK_WAIT_MS; waited += 20) {
+        sendQueuedCommands();
+        if (done()) {
+            return true;
+        }
+        pollfd watch = {mockSocket, POLLIN, 0};
+        if (poll(&watch, 1, 20) > 0 && !receiveMessage()) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static int light = -1;
+
+static bool lightUpdated() { return mappingUpdated[light]; }
+static bool lightOff() { return !mappingOn[light]; }
+static bool lightDimmed() { return mappingBrightness[light] == 40; }
+
+static void authenticate() {
+    setCommandLinkState(COMMAND_LINK_CONNECTED);
+    queueCommand(COMMAND_AUTH);
+}
+
+int main() {
+    int port = freePort();
+    pid_t mock = startMock(port);
+    if (mock < 0) {
+        printf("test_mock_client: skipped (python3 not found)\n");
+        return 0;
+    }
+    initializeEntityStates();
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        if (strcmp(entityMappings[i].entity_id, "light.example1") == 0) {
+            light = i;
+        }
+    }
+    CHECK(light >= 0);
+
+    CHECK(connectMock(port));
+    authenticate();
+
+    // The snapshot shows every light on at full brightness
+    CHECK(pump(lightUpdated));
+    CHECK(mappingOn[light]);
+    CHECK_EQUAL(255, mappingBrightness[light]);
+
+    // A toggle goes out as a call and comes back as a delta
+    toggleEntity(entityMappings[light].x, entityMappings[light].y);
+    CHECK(pump(lightOff));
+
+    // A level turns the light back on at that brightness
+    int mappings[] = {light};
+    int values[] = {40};
+    sendBrightnessOrVolumeUpdates(mappings, values, 1);
+    CHECK(pump(lightDimmed));
+    CHECK(mappingOn[light]);
+
+    // A press while offline is kept and sent once the new connection is authenticated
+    disconnectMock();
+    toggleEntity(entityMappings[light].x, entityMappings[light].y);
+    sentMessages = 0;
+    sendQueuedCommands();
+    CHECK_EQUAL(0, sentMessages);
+    CHECK_EQUAL(1, queuedCommandCount());
+
+    CHECK(connectMock(port));
+    authenticate();
+    CHECK(pump(lightOff));
+    CHECK_EQUAL(0, queuedCommandCount());
+
+    disconnectMock();
+    kill(mock, SIGTERM);
+    waitpid(mock, nullptr, 0);
+    return testResult("test_mock_client");
+}
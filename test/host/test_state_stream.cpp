@@ -0,0 +1,187 @@
+#include "state_stream.h"
+#include "test.h"
+#include <string>
+#include <vector>
+
+// Feeds Home Assistant messages to the state stream whole and in fragments, and checks the
+// entity updates it applies against the example config's mappings
+
+struct AppliedUpdate {
+    int page, x, y;
+    EntityUpdate update;
+};
+
+static std::vector<AppliedUpdate> applied;
+
+void updateLEDState(int page, int x, int y, const EntityUpdate* update) {
+    AppliedUpdate entry = {page, x, y, *update};
+    applied.push_back(entry);
+}
+
+static bool receive(const std::string& message, size_t fragmentSize) {
+    applied.clear();
+    beginStateStream();
+    bool fed = true;
+    for (size_t offset = 0; offset < message.size(); offset += fragmentSize) {
+        fed = feedStateStream((const uint8_t*)message.data() + offset, std::min(fragmentSize, message.size() - offset)) && fed;
+    }
+    return finishStateStream() && fed;
+}
+
+static bool sameUpdates(const std::vector<AppliedUpdate>& a, const std::vector<AppliedUpdate>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        const EntityUpdate& u = a[i].update;
+        const EntityUpdate& v = b[i].update;
+        if (a[i].page != b[i].page || a[i].x != b[i].x || a[i].y != b[i].y || u.has_state != v.has_state ||
+            u.is_on != v.is_on || u.has_attributes != v.has_attributes || u.has_rgb != v.has_rgb || u.r != v.r ||
+            u.g != v.g || u.b != v.b || u.has_brightness != v.has_brightness || u.brightness != v.brightness ||
+            u.has_volume != v.has_volume || u.volume != v.volume || u.member != v.member) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Receives the message whole and checks that every fragment size applies the same updates
+static void receiveEverySplit(const std::string& message) {
+    CHECK(receive(message, message.size()));
+    std::vector<AppliedUpdate> whole = applied;
+    static const size_t fragmentSizes[] = {1, 5, 64, 1000};
+    for (size_t i = 0; i < sizeof(fragmentSizes) / sizeof(fragmentSizes[0]); i++) {
+        CHECK(receive(message, fragmentSizes[i]));
+        CHECK(sameUpdates(applied, whole));
+    }
+}
+
+static int mappingIndex(const char* entity_id) {
+    for (int i = 0; i < NUM_MAPPINGS; i++) {
+        if (strcmp(entityMappings[i].entity_id, entity_id) == 0) return i;
+    }
+    return -1;
+}
+
+// The update applied to a mapping's key, or null
+static const EntityUpdate* updateFor(const char* entity_id) {
+    const EntityMapping& mapping = entityMappings[mappingIndex(entity_id)];
+    for (size_t i = 0; i < applied.size(); i++) {
+        if (applied[i].page == mapping.page && applied[i].x == mapping.x && applied[i].y == mapping.y) {
+            return &applied[i].update;
+        }
+    }
+    return nullptr;
+}
+
+static void testMessageFields() {
+    CHECK(receive("{\"type\":\"auth_ok\",\"ha_version\":\"2024.1\"}", 3));
+    CHECK(strcmp(stateStreamMessageType(), "auth_ok") == 0);
+    CHECK_EQUAL(0, stateStreamMessageId());
+
+    CHECK(receive("{\"id\":42,\"type\":\"result\",\"success\":true,\"result\":{\"id\":7,\"success\":false}}", 1));
+    CHECK(strcmp(stateStreamMessageType(), "result") == 0);
+    CHECK_EQUAL(42, stateStreamMessageId()); // The nested id and success are not the message's
+    CHECK(stateStreamMessageSucceeded());
+
+    CHECK(receive("{\"id\":43,\"type\":\"result\",\"success\":false,\"error\":{\"code\":\"unauthorized\"}}", 7));
+    CHECK(!stateStreamMessageSucceeded());
+    CHECK(receive("{\"id\":44,\"type\":\"pong\"}", 7));
+    CHECK(!stateStreamMessageSucceeded());
+    CHECK_EQUAL(44, stateStreamMessageId());
+}
+
+static void testSnapshot() {
+    receiveEverySplit(
+        "{\"id\":2,\"type\":\"event\",\"event\":{\"a\":{"
+        "\"light.example1\":{\"s\":\"on\",\"a\":{\"friendly_name\":\"Lamp\",\"rgb_color\":[255,120,0],"
+        "\"hs_color\":[30.5,100],\"brightness\":200,\"effect_list\":[\"a\",\"b\"]},\"c\":\"01H\",\"lc\":1.5},"
+        "\"sensor.unmapped\":{\"s\":\"on\",\"a\":{\"brightness\":1}},"
+        "\"media_player.example1\":{\"s\":\"playing\",\"a\":{\"volume_level\":0.45}},"
+        "\"light.example3\":{\"s\":\"off\",\"a\":{\"brightness\":null,\"rgb_color\":null}}}}}");
+
+    const EntityUpdate* lamp = updateFor("light.example1");
+    CHECK(lamp && lamp->has_state && lamp->is_on && lamp->has_rgb && lamp->r == 255 && lamp->g == 120 && lamp->b == 0);
+    CHECK(lamp && lamp->has_brightness && lamp->brightness == 200 && !lamp->has_volume);
+    const EntityUpdate* player = updateFor("media_player.example1");
+    CHECK(player && player->is_on && player->has_volume && player->volume > 0.449f && player->volume < 0.451f);
+    const EntityUpdate* off = updateFor("light.example3");
+    CHECK(off && off->has_state && !off->is_on && off->has_rgb && off->has_brightness && off->brightness == 0);
+
+    // light.example1 is also a member of a group key, which gets its own update
+    int group = mappingIndex("light.example1,light.example2,switch.example1");
+    int groupUpdates = 0;
+    for (size_t i = 0; i < applied.size(); i++) {
+        if (applied[i].x == entityMappings[group].x && applied[i].y == entityMappings[group].y &&
+            applied[i].page == entityMappings[group].page) {
+            CHECK_EQUAL(0, applied[i].update.member);
+            groupUpdates++;
+        }
+    }
+    CHECK_EQUAL(1, groupUpdates);
+    CHECK_EQUAL(4, applied.size());
+}
+
+static void testDeltas() {
+    receiveEverySplit(
+        "{\"id\":2,\"type\":\"event\",\"event\":{\"c\":{"
+        "\"light.example2\":{\"+\":{\"a\":{\"brightness\":12}},\"-\":{\"a\":[\"brightness\",\"rgb_color\"]}},"
+        "\"media_player.example1\":{\"-\":{\"a\":[\"volume_level\"]}}}}}");
+    const EntityUpdate* lamp = updateFor("light.example2");
+    CHECK(lamp && !lamp->has_state && lamp->has_attributes && lamp->has_brightness && lamp->brightness == 12);
+    CHECK(lamp && !lamp->has_rgb);
+    const EntityUpdate* player = updateFor("media_player.example1");
+    CHECK(player && !player->has_state && !player->has_attributes && !player->has_volume); // Removals are ignored
+}
+
+static void testCompactTemplate() {
+    // Records follow entityMappings; the first is light.example1
+    std::string message = "{\"id\":5,\"type\":\"event\",\"event\":{\"result\":\"1,255,0,0,200,-1;0,-1,-1,-1,-1,-1;\","
+                          "\"listeners\":{\"all\":false,\"entities\":[\"light.example1\"],\"time\":false}}}";
+    receiveEverySplit(message);
+    CHECK_EQUAL(2, applied.size());
+    const EntityUpdate* lamp = updateFor(entityMappings[0].entity_id);
+    CHECK(lamp && lamp->is_on && lamp->has_rgb && lamp->r == 255 && lamp->brightness == 200 && !lamp->has_volume);
+}
+
+static void testLargeSnapshot() {
+    // Hundreds of KB of entities the deck doesn't map, with the mapped one last
+    std::string message = "{\"id\":2,\"type\":\"event\",\"event\":{\"a\":{";
+    std::string padding(2000, 'x');
+    char entity[64];
+    for (int i = 0; i < 200; i++) {
+        snprintf(entity, sizeof(entity), "\"sensor.unmapped_%d\":", i);
+        message += entity;
+        message += "{\"s\":\"on\",\"a\":{\"brightness\":5,\"padding\":\"" + padding + "\",\"nested\":[[[{\"a\":1}]]]}},";
+    }
+    message += "\"light.example4\":{\"s\":\"on\",\"a\":{\"brightness\":77}}}}}";
+    CHECK(message.size() > 400000);
+    CHECK(receive(message, 4096));
+    CHECK_EQUAL(1, applied.size());
+    const EntityUpdate* lamp = updateFor("light.example4");
+    CHECK(lamp && lamp->is_on && lamp->brightness == 77);
+}
+
+static void testTooDeep() {
+    // An attribute nested past the tokenizer's limit fails the message; entities already closed stay applied
+    std::string message = "{\"id\":2,\"type\":\"event\",\"event\":{\"a\":{"
+                          "\"light.example5\":{\"s\":\"on\",\"a\":{}},"
+                          "\"sensor.deep\":{\"s\":\"on\",\"a\":{\"x\":" +
+                          std::string(JSON_STREAM_MAX_DEPTH, '[') + std::string(JSON_STREAM_MAX_DEPTH, ']') + "}}}}}";
+    CHECK(!receive(message, 1));
+    CHECK_EQUAL(1, applied.size());
+    CHECK(updateFor("light.example5") != nullptr);
+
+    // The next message starts afresh
+    CHECK(receive("{\"id\":9,\"type\":\"pong\"}", 1));
+    CHECK(strcmp(stateStreamMessageType(), "pong") == 0);
+}
+
+int main() {
+    initializeEntityStates();
+    testMessageFields();
+    testSnapshot();
+    testDeltas();
+    testCompactTemplate();
+    testLargeSnapshot();
+    testTooDeep();
+    return testResult("test_state_stream");
+}
@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+"""TCP proxy that injects network faults between the deck and Home Assistant.
+
+Point HA_HOST/HA_PORT in secrets.h at the machine running this script and give it
+the real (or mock) Home Assistant as upstream:
+
+    python3 tools/chaos_proxy.py --port 8123 --upstream 127.0.0.1:18123 --profile jitter
+
+Profiles:
+    clean      forward unchanged
+    latency    add 300 ms in each direction
+    jitter     add 100-500 ms, in order, in each direction
+    stall      stop forwarding on open connections until the fault clears; new ones work
+    half_open  like stall, but frozen connections never resume and the server never
+               sees them close, like a NAT entry lost in a router reboot
+    reset      abort every open connection with a TCP reset; new ones work
+    outage     reset every connection and refuse new ones until the fault clears
+
+--fault-after 30 --fault-for 20 keeps the link clean for 30 seconds, applies the
+profile for 20 and then clears it again, repeating every --fault-period seconds.
+tools/recovery_bench.py drives the proxy from code to measure recovery.
+
+Only the Python standard library is used.
+"""
+
+import argparse
+import asyncio
+import random
+import socket
+import struct
+import time
+
+
+class Fault:
+    def __init__(self, latency=0.0, jitter=0.0, freeze=False, never_thaw=False, reset=False, refuse=False):
+        self.latency = latency       # Seconds added to every chunk
+        self.jitter = jitter         # Up to this many more seconds, random per chunk
+        self.freeze = freeze         # Stop forwarding on connections open while the fault is applied
+        self.never_thaw = never_thaw # Frozen connections stay frozen after the fault clears
+        self.reset = reset           # Abort connections open when the fault is applied
+        self.refuse = refuse         # Reset new connections while applied, or freeze them as well with freeze
+
+
+PROFILES = {
+    "clean": Fault(),
+    "latency": Fault(latency=0.3),
+    "jitter": Fault(latency=0.1, jitter=0.4),
+    "stall": Fault(freeze=True),
+    "half_open": Fault(freeze=True, never_thaw=True, refuse=True),
+    "reset": Fault(reset=True),
+    "outage": Fault(reset=True, refuse=True),
+}
+
+
+def abort(writer):
+    """Closes with a TCP reset instead of a FIN, like a peer that lost the connection."""
+    sock = writer.get_extra_info("socket")
+    if sock is not None:
+        try:
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+        except OSError:
+            pass
+    writer.transport.abort()
+
+
+class Link:
+    """One client connection and its upstream connection."""
+
+    def __init__(self, proxy, number, client_writer):
+        self.proxy = proxy
+        self.number = number
+        self.client_writer = client_writer
+        self.upstream_writer = None
+        self.upstream_port = None   # Local port of the upstream socket, as the server sees it
+        self.frozen = False
+        self.never_thaw = False
+        self.thawed = asyncio.Event()
+        self.closed = False
+        self.tasks = []
+
+    def freeze(self, never_thaw):
+        self.frozen = True
+        self.never_thaw = self.never_thaw or never_thaw
+        self.thawed.clear()
+
+    def thaw(self):
+        if self.frozen and not self.never_thaw:
+            self.frozen = False
+            self.thawed.set()
+
+    def close(self, reset=False):
+        if self.closed:
+            return
+        self.closed = True
+        for writer in (self.client_writer, self.upstream_writer):
+            if writer is None:
+                continue
+            if reset:
+                abort(writer)
+            else:
+                writer.close()
+        for task in self.tasks:
+            if task is not asyncio.current_task():
+                task.cancel()
+        self.proxy.links.discard(self)
+        self.proxy.notify("closed", self)
+
+    async def pump(self, reader, writer, upstream_to_client):
+        """Copies one direction, delaying each chunk and keeping chunks in order."""
+        queue = asyncio.Queue()
+
+        async def deliver():
+            while True:
+                item = await queue.get()
+                if item is None:
+                    return
+                data, received_at, due = item
+                delay = due - time.monotonic()
+                if delay > 0:
+                    await asyncio.sleep(delay)
+                while self.frozen:
+                    await self.thawed.wait()
+                writer.write(data)
+                await writer.drain()
+                if upstream_to_client:
+                    self.proxy.notify("delivered", self, received_at)
+
+        sender = asyncio.ensure_future(deliver())
+        self.tasks.append(sender)
+        last_due = 0.0
+        try:
+            while True:
+                data = await reader.read(65536)
+                if not data:
+                    break
+                now = time.monotonic()
+                fault = self.proxy.fault
+                # Chunks never overtake each other, so jitter stretches gaps instead of reordering
+                last_due = max(last_due, now + fault.latency + random.uniform(0, fault.jitter))
+                queue.put_nowait((data, now, last_due))
+            queue.put_nowait(None)
+            await sender  # Whatever was still delayed goes out before the close
+        except (ConnectionError, OSError):
+            pass
+        if self.never_thaw:
+            if not upstream_to_client:
+                # The client gave up on the half-open link; the server is never told
+                self.client_writer.close()
+            return
+        self.close()
+
+
+class ChaosProxy:
+    def __init__(self, upstream_host, upstream_port):
+        self.upstream_host = upstream_host
+        self.upstream_port = upstream_port
+        self.fault = PROFILES["clean"]
+        self.links = set()
+        self.observers = []
+        self.connections = 0
+        self.resets = 0
+
+    def notify(self, event, link, *details):
+        for observer in self.observers:
+            observer(event, link, *details)
+
+    def apply(self, fault):
+        """Switches to a fault profile; open connections are frozen or reset as it asks."""
+        self.fault = fault
+        for link in list(self.links):
+            if fault.reset:
+                self.resets += 1
+                link.close(reset=True)
+            elif fault.freeze:
+                link.freeze(fault.never_thaw)
+
+    def clear(self):
+        self.fault = PROFILES["clean"]
+        for link in list(self.links):
+            link.thaw()
+
+    async def handle_client(self, client_reader, client_writer):
+        self.connections += 1
+        link = Link(self, self.connections, client_writer)
+        if self.fault.refuse and not self.fault.freeze:
+            self.resets += 1
+            abort(client_writer)
+            self.notify("refused", link)
+            return
+        try:
+            upstream_reader, link.upstream_writer = await asyncio.open_connection(self.upstream_host,
+                                                                                  self.upstream_port)
+        except OSError as error:
+            print("upstream connection failed: %s" % error)
+            client_writer.close()
+            return
+        link.upstream_port = link.upstream_writer.get_extra_info("sockname")[1]
+        self.links.add(link)
+        if self.fault.refuse and self.fault.freeze:
+            link.freeze(self.fault.never_thaw)
+        self.notify("opened", link)
+        link.tasks = [asyncio.ensure_future(link.pump(client_reader, link.upstream_writer, False)),
+                      asyncio.ensure_future(link.pump(upstream_reader, client_writer, True))]
+        await asyncio.gather(*link.tasks, return_exceptions=True)
+
+    async def start(self, host, port):
+        return await asyncio.start_server(self.handle_client, host, port)
+
+
+def log_event(event, link, *details):
+    if event != "delivered":
+        print("[%.3f] connection %d %s" % (time.monotonic(), link.number, event))
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8123)
+    parser.add_argument("--upstream", required=True, help="host:port of Home Assistant or tools/mock_ha.py")
+    parser.add_argument("--profile", choices=sorted(PROFILES), default="clean")
+    parser.add_argument("--fault-after", type=float, default=0,
+                        help="Seconds of clean link before the profile is applied")
+    parser.add_argument("--fault-for", type=float, default=0,
+                        help="Seconds the profile stays applied (default: until the proxy stops)")
+    parser.add_argument("--fault-period", type=float, default=0,
+                        help="Repeat the fault this many seconds after it was last applied (default: once)")
+    args = parser.parse_args()
+
+    upstream_host, upstream_port = args.upstream.rsplit(":", 1)
+    proxy = ChaosProxy(upstream_host, int(upstream_port))
+    proxy.observers.append(log_event)
+    server = await proxy.start(args.host, args.port)
+    print("chaos proxy listening on %s:%d, forwarding to %s" % (args.host, args.port, args.upstream))
+
+    async with server:
+        await asyncio.sleep(args.fault_after)
+        while True:
+            print("[%.3f] applying %s" % (time.monotonic(), args.profile))
+            proxy.apply(PROFILES[args.profile])
+            if not args.fault_for:
+                await asyncio.Event().wait()
+            await asyncio.sleep(args.fault_for)
+            print("[%.3f] fault cleared" % time.monotonic())
+            proxy.clear()
+            if not args.fault_period:
+                await asyncio.Event().wait()
+            await asyncio.sleep(max(0, args.fault_period - args.fault_for))
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+"""Measures how fast a deck fails over between two Home Assistant endpoints.
+
+Runs two tools/mock_ha.py instances, each behind its own tools/chaos_proxy.py, in one
+process. Point HA_HOST/HA_PORT at this machine and --port, and HA_STANDBY_ENDPOINTS at
+this machine and --standby-port, then run, for example
+
+    python3 tools/failover_bench.py --port 8123 --standby-port 8124 --repeat 5
+
+Both mocks hold the same entities and every change is applied to both, like two
+instances that mirror the same devices. Each run applies a fault profile (default
+outage, which is how a restarting Home Assistant looks) to the endpoint the deck is
+using and reports:
+
+    detect     fault until the deck opened a connection to the other endpoint
+    handshake  from that connection opening until the mock accepted it, which with --tls-cert
+               is the TLS handshake
+    subscribe  fault until the deck subscribed on the other endpoint
+    fresh      fault until the first state from the other endpoint reached the deck; the
+               keys show the states cached before the fault until then
+    deck       the deck's own failover time (needs --metrics-url)
+
+The fault is cleared once the deck has moved, so the next run fails the other endpoint
+and the deck moves back.
+
+With --tls-cert and --tls-key both mocks serve wss://, for a deck built with HA_USE_TLS. The
+deck restarts its failover timeout once the socket is open, so a handshake that takes longer
+than WEBSOCKET_FAILOVER_TIMEOUT_MS should still end in a subscription rather than a failed run.
+
+    python3 tools/failover_bench.py --tls-cert cert.pem --tls-key key.pem --profile outage
+
+Only the Python standard library is used.
+"""
+
+import argparse
+import asyncio
+import statistics
+import sys
+import time
+
+import chaos_proxy
+import mock_ha
+from recovery_bench import scrape, seconds
+
+
+class Endpoint:
+    """A mock Home Assistant behind its own proxy."""
+
+    def __init__(self, name, args, mock_port, port):
+        self.name = name
+        self.port = port
+        self.mock_port = mock_port
+        self.mock = mock_ha.MockHomeAssistant(argparse.Namespace(
+            token=args.token, rate=0, delta_size=1, attribute_padding=0, fragment_size=0,
+            max_backlog=64 * 1024, report_interval=10, stall_after=0, calls_log=None, refuse_scripts=False))
+        self.proxy = chaos_proxy.ChaosProxy("127.0.0.1", mock_port)
+        self.subscribed_ports = set()  # Upstream ports of proxy links whose client has subscribed
+
+    async def start(self, host, tls):
+        self.mock_server = await asyncio.start_server(self.mock.handle_client, "127.0.0.1", self.mock_port, ssl=tls)
+        self.proxy_server = await self.proxy.start(host, self.port)
+
+
+class Bench:
+    def __init__(self, args, endpoints):
+        self.args = args
+        self.endpoints = endpoints
+        self.entity_ids = []
+        self.waiters = []  # (endpoint, event, after, future)
+        for endpoint in endpoints:
+            endpoint.mock.observers.append(lambda event, connection, e=endpoint: self.on_mock(e, event, connection))
+            endpoint.proxy.observers.append(lambda event, link, *details, e=endpoint: self.on_proxy(e, event, link,
+                                                                                                    *details))
+
+    def resolve(self, endpoint, event, at):
+        now = time.monotonic()
+        for waiter in self.waiters:
+            if waiter[0] is endpoint and waiter[1] == event and at >= waiter[2] and not waiter[3].done():
+                waiter[3].set_result(now)
+        self.waiters = [w for w in self.waiters if not w[3].done()]
+
+    def on_mock(self, endpoint, event, connection):
+        if event == "connected":
+            self.resolve(endpoint, "connected", time.monotonic())
+        elif event == "subscribed":
+            endpoint.subscribed_ports.add(connection.writer.get_extra_info("peername")[1])
+            self.entity_ids = sorted(connection.entity_ids or connection.template_ids)
+            self.resolve(endpoint, "subscribed", time.monotonic())
+
+    def on_proxy(self, endpoint, event, link, *details):
+        if event == "opened":
+            self.resolve(endpoint, "opened", time.monotonic())
+        elif event == "delivered" and link.upstream_port in endpoint.subscribed_ports:
+            self.resolve(endpoint, "delivered", details[0])
+
+    def wait_for(self, endpoint, event, after):
+        """Resolves with the time of the first `event` on `endpoint` at or after `after`."""
+        future = asyncio.get_event_loop().create_future()
+        self.waiters.append((endpoint, event, after, future))
+        return future
+
+    async def change_entities(self):
+        """Toggles one of the subscribed entities on both endpoints every --change-interval seconds."""
+        while True:
+            await asyncio.sleep(self.args.change_interval)
+            if not self.entity_ids:
+                continue
+            entity_id = self.entity_ids[int(time.monotonic() / self.args.change_interval) % len(self.entity_ids)]
+            for endpoint in self.endpoints:
+                endpoint.mock.broadcast({entity_id: endpoint.mock.model.toggle(entity_id)})
+
+    async def active_endpoint(self):
+        """Waits until the deck receives data through one of the endpoints and returns it."""
+        now = time.monotonic()
+        waits = {asyncio.ensure_future(self.wait_for(e, "delivered", now)): e for e in self.endpoints}
+        done, pending = await asyncio.wait(waits, timeout=self.args.timeout, return_when=asyncio.FIRST_COMPLETED)
+        for future in pending:
+            future.cancel()
+        if not done:
+            sys.exit("no subscribed deck on port %d or %d after %.0f s" % (
+                self.endpoints[0].port, self.endpoints[1].port, self.args.timeout))
+        return waits[done.pop()]
+
+    async def metrics(self):
+        if not self.args.metrics_url:
+            return None
+        try:
+            return await asyncio.get_event_loop().run_in_executor(None, scrape, self.args.metrics_url)
+        except (OSError, ValueError) as error:
+            print("could not read %s: %s" % (self.args.metrics_url, error))
+            return None
+
+    async def run(self):
+        failing = await self.active_endpoint()
+        other = self.endpoints[1] if failing is self.endpoints[0] else self.endpoints[0]
+        before = await self.metrics()
+
+        started = time.monotonic()
+        opened = self.wait_for(other, "opened", started)
+        connected = self.wait_for(other, "connected", started)
+        subscribed = self.wait_for(other, "subscribed", started)
+        fresh = self.wait_for(other, "delivered", started)
+        failing.proxy.apply(chaos_proxy.PROFILES[self.args.profile])
+
+        result = {"from": failing.name, "detect": None, "handshake": None, "subscribe": None, "fresh": None,
+                  "deck": None}
+        try:
+            opened_at = await asyncio.wait_for(opened, self.args.timeout)
+            result["detect"] = opened_at - started
+            result["handshake"] = await asyncio.wait_for(connected, self.args.timeout) - opened_at
+            result["subscribe"] = await asyncio.wait_for(subscribed, self.args.timeout) - started
+            result["fresh"] = await asyncio.wait_for(fresh, self.args.timeout) - started
+        except asyncio.TimeoutError:
+            pass
+        failing.proxy.clear()
+
+        await asyncio.sleep(self.args.settle_seconds)
+        after = await self.metrics()
+        if before and after and after["deck_websocket_failovers_total"] > before["deck_websocket_failovers_total"]:
+            result["deck"] = after["deck_websocket_failover_seconds"]
+        return result
+
+
+def print_summary(results):
+    print("\n%-10s %5s %9s %9s %9s %9s %9s %9s %9s" % ("from", "runs", "detect", "handshake", "subscribe", "fresh",
+                                                      "fresh", "deck", "failed"))
+    print("%-10s %5s %9s %9s %9s %9s %9s %9s %9s" % ("", "", "median", "max", "median", "median", "max", "median",
+                                                      ""))
+    for name in dict.fromkeys(r["from"] for r in results):
+        runs = [r for r in results if r["from"] == name]
+
+        def column(key, combine):
+            values = [r[key] for r in runs if r[key] is not None]
+            return combine(values) if values else None
+
+        print("%-10s %5d %9s %9s %9s %9s %9s %9s %9d" % (
+            name, len(runs), seconds(column("detect", statistics.median)), seconds(column("handshake", max)),
+            seconds(column("subscribe", statistics.median)), seconds(column("fresh", statistics.median)),
+            seconds(column("fresh", max)), seconds(column("deck", statistics.median)),
+            sum(1 for r in runs if r["fresh"] is None)))
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8123, help="Port of the primary endpoint (HA_PORT)")
+    parser.add_argument("--standby-port", type=int, default=8124, help="Port of the standby endpoint")
+    parser.add_argument("--mock-port", type=int, default=18123,
+                        help="Local port of the primary mock; the standby mock uses the next one")
+    parser.add_argument("--token", default="", help="Require this access token (default: accept any)")
+    parser.add_argument("--profile", choices=sorted(chaos_proxy.PROFILES), default="outage",
+                        help="Fault applied to the endpoint in use")
+    parser.add_argument("--repeat", type=int, default=4, help="Failovers to measure")
+    parser.add_argument("--timeout", type=float, default=60,
+                        help="Seconds to wait for the deck before a run counts as failed")
+    parser.add_argument("--settle-seconds", type=float, default=2,
+                        help="Seconds between runs, so the deck is settled on its new endpoint")
+    parser.add_argument("--change-interval", type=float, default=0.25, help="Seconds between entity changes")
+    parser.add_argument("--metrics-url", help="The deck's /metrics endpoint (ENABLE_METRICS_ENDPOINT)")
+    parser.add_argument("--tls-cert", help="Serve wss:// from both mocks with this PEM certificate (chain)")
+    parser.add_argument("--tls-key", help="Private key for --tls-cert")
+    args = parser.parse_args()
+    tls = mock_ha.tls_context(args.tls_cert, args.tls_key)
+
+    endpoints = [Endpoint("primary", args, args.mock_port, args.port),
+                 Endpoint("standby", args, args.mock_port + 1, args.standby_port)]
+    bench = Bench(args, endpoints)
+    for endpoint in endpoints:
+        await endpoint.start(args.host, tls)
+    changer = asyncio.ensure_future(bench.change_entities())
+    print("waiting for the deck on %s port %d or %d" % ("wss" if tls else "ws", args.port, args.standby_port))
+
+    results = []
+    for run in range(args.repeat):
+        result = await bench.run()
+        results.append(result)
+        print("run %d from %s: detect %s s, handshake %s s, subscribe %s s, fresh %s s, deck %s s" % (
+            run + 1, result["from"], seconds(result["detect"]), seconds(result["handshake"]),
+            seconds(result["subscribe"]), seconds(result["fresh"]), seconds(result["deck"])))
+
+    changer.cancel()
+    for endpoint in endpoints:
+        for link in list(endpoint.proxy.links):
+            link.close()
+        endpoint.proxy_server.close()
+        endpoint.mock_server.close()
+    await asyncio.sleep(0.1)  # Lets the mocks see the connections close
+    print_summary(results)
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
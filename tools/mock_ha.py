@@ -0,0 +1,422 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Home Assistant WebSocket API.
+
+Speaks enough of the protocol for the deck firmware: auth, subscribe_entities,
+render_template, call_service, execute_script and ping. Entity snapshots and "c" deltas are
+generated at a configurable rate and size, and every service call is recorded
+with a timestamp.
+
+Point HA_HOST/HA_PORT in secrets.h at the machine running this script, e.g.
+
+    python3 tools/mock_ha.py --port 8123 --rate 20 --delta-size 3 --calls-log calls.csv
+
+--stall-after 30 stops answering each connection 30 seconds in without closing it,
+to check that the firmware's heartbeat notices and reconnects.
+
+--refuse-scripts answers execute_script with an error, as Home Assistant does for a
+non-admin token, to check that batched levels are sent again one call at a time.
+
+Large snapshots split across frames (--attribute-padding 20000 --fragment-size 4096)
+exercise the firmware's streaming parser.
+
+--tls-cert cert.pem --tls-key key.pem serves wss:// for decks built with HA_USE_TLS.
+Each connection logs its TLS version and cipher.
+
+Only the Python standard library is used.
+"""
+
+import argparse
+import asyncio
+import base64
+import hashlib
+import json
+import random
+import re
+import ssl
+import struct
+import time
+
+WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+OP_CONTINUATION, OP_TEXT, OP_CLOSE, OP_PING, OP_PONG = 0x0, 0x1, 0x8, 0x9, 0xA
+
+
+class Stats:
+    def __init__(self):
+        self.frames_sent = 0
+        self.bytes_sent = 0
+        self.deltas_sent = 0
+        self.deltas_dropped = 0
+        self.calls = 0
+        self.connections = 0
+
+    def line(self):
+        return (f"conns={self.connections} frames={self.frames_sent} bytes={self.bytes_sent} "
+                f"deltas={self.deltas_sent} dropped={self.deltas_dropped} calls={self.calls}")
+
+
+class EntityModel:
+    """Current state of every entity a client has asked about."""
+
+    def __init__(self, padding):
+        self.states = {}
+        self.padding = "x" * padding
+
+    def ensure(self, entity_id):
+        if entity_id not in self.states:
+            domain = entity_id.split(".", 1)[0]
+            attributes = {"friendly_name": entity_id}
+            if self.padding:
+                attributes["padding"] = self.padding
+            if domain == "light":
+                attributes.update(brightness=255, rgb_color=[255, 255, 255])
+                state = "on"
+            elif domain == "media_player":
+                attributes.update(volume_level=0.5)
+                state = "playing"
+            else:
+                state = "off"
+            self.states[entity_id] = {"s": state, "a": attributes}
+        return self.states[entity_id]
+
+    def mutate(self, entity_id):
+        """Randomly changes an entity and returns the "+" part of a delta."""
+        entity = self.ensure(entity_id)
+        domain = entity_id.split(".", 1)[0]
+        if domain == "light" and entity["s"] == "on" and random.random() < 0.5:
+            entity["a"]["brightness"] = random.randint(1, 255)
+            return {"a": {"brightness": entity["a"]["brightness"]}}
+        if domain == "media_player" and random.random() < 0.5:
+            entity["a"]["volume_level"] = round(random.random(), 2)
+            return {"a": {"volume_level": entity["a"]["volume_level"]}}
+        return self.toggle(entity_id)
+
+    def toggle(self, entity_id):
+        entity = self.ensure(entity_id)
+        if entity_id.startswith("media_player."):
+            return self.set(entity_id, "paused" if entity["s"] == "playing" else "playing")
+        return self.set(entity_id, "off" if entity["s"] == "on" else "on")
+
+    def set(self, entity_id, state=None, **attributes):
+        entity = self.ensure(entity_id)
+        if state is not None:
+            entity["s"] = state
+        if entity_id.startswith("light."):
+            # Like HA, lights only report colour and brightness while on
+            if entity["s"] == "on":
+                entity["a"]["brightness"] = entity["a"].get("brightness") or 255
+                entity["a"]["rgb_color"] = entity["a"].get("rgb_color") or [255, 255, 255]
+            else:
+                entity["a"].update(brightness=None, rgb_color=None)
+        entity["a"].update(attributes)
+        return {"s": entity["s"], "a": entity["a"]}
+
+    def compact(self, entity_ids):
+        """Renders the same packed string as the firmware's state template."""
+        records = []
+        for entity_id in entity_ids:
+            entity = self.ensure(entity_id)
+            a = entity["a"]
+            rgb = a.get("rgb_color") or [-1, -1, -1]
+            brightness = a.get("brightness")
+            volume = a.get("volume_level")
+            records.append("%d,%d,%d,%d,%d,%d" % (
+                1 if entity["s"] in ("on", "playing") else 0, rgb[0], rgb[1], rgb[2],
+                brightness if brightness is not None else -1,
+                int(volume * 255) if volume is not None else -1))
+        return ";".join(records) + ";"
+
+
+class Connection:
+    def __init__(self, server, reader, writer):
+        self.server = server
+        self.reader = reader
+        self.writer = writer
+        self.entity_subscription = None
+        self.entity_ids = []
+        self.template_subscription = None
+        self.template_ids = []
+        self.stalled = False
+
+    async def handshake(self):
+        request = await self.reader.readuntil(b"\r\n\r\n")
+        headers = {}
+        for line in request.decode().split("\r\n")[1:]:
+            if ":" in line:
+                name, value = line.split(":", 1)
+                headers[name.strip().lower()] = value.strip()
+        accept = base64.b64encode(hashlib.sha1((headers["sec-websocket-key"] + WS_GUID).encode()).digest())
+        self.writer.write(b"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          b"Sec-WebSocket-Accept: " + accept + b"\r\n\r\n")
+
+    async def read_frame(self):
+        """Returns (opcode, payload) of the next complete message."""
+        message = b""
+        while True:
+            head = await self.reader.readexactly(2)
+            fin, opcode = head[0] & 0x80, head[0] & 0x0F
+            length = head[1] & 0x7F
+            if length == 126:
+                length = struct.unpack(">H", await self.reader.readexactly(2))[0]
+            elif length == 127:
+                length = struct.unpack(">Q", await self.reader.readexactly(8))[0]
+            mask = await self.reader.readexactly(4) if head[1] & 0x80 else b"\0\0\0\0"
+            data = bytes(b ^ mask[i % 4] for i, b in enumerate(await self.reader.readexactly(length)))
+            if opcode >= 0x8:
+                return opcode, data
+            message += data
+            if fin:
+                return OP_TEXT, message
+
+    def send_frame(self, opcode, data, fin=True):
+        length = len(data)
+        first = (0x80 if fin else 0) | opcode
+        if length < 126:
+            head = struct.pack(">BB", first, length)
+        elif length < 65536:
+            head = struct.pack(">BBH", first, 126, length)
+        else:
+            head = struct.pack(">BBQ", first, 127, length)
+        self.writer.write(head + data)
+
+    def send(self, message):
+        if self.stalled:
+            return
+        data = json.dumps(message, separators=(",", ":")).encode()
+        size = self.server.args.fragment_size
+        if size and len(data) > size:
+            # First frame carries the opcode, the rest are continuation frames (opcode 0)
+            for offset in range(0, len(data), size):
+                self.send_frame(OP_TEXT if offset == 0 else OP_CONTINUATION, data[offset:offset + size],
+                                fin=offset + size >= len(data))
+        else:
+            self.send_frame(OP_TEXT, data)
+        self.server.stats.frames_sent += 1
+        self.server.stats.bytes_sent += len(data)
+
+    def congested(self):
+        return self.writer.transport.get_write_buffer_size() > self.server.args.max_backlog
+
+    def push_changes(self, changes):
+        """Sends a delta to whichever subscriptions cover the changed entities."""
+        if self.entity_subscription is not None:
+            relevant = {e: {"+": c} for e, c in changes.items() if e in self.entity_ids}
+            if relevant:
+                self.send({"id": self.entity_subscription, "type": "event", "event": {"c": relevant}})
+        if self.template_subscription is not None and any(e in self.template_ids for e in changes):
+            self.send({"id": self.template_subscription, "type": "event",
+                       "event": {"result": self.server.model.compact(self.template_ids), "listeners": {}}})
+
+    async def handle_message(self, message):
+        kind = message.get("type")
+        model = self.server.model
+
+        if kind == "auth":
+            if self.server.args.token and message.get("access_token") != self.server.args.token:
+                self.send({"type": "auth_invalid", "message": "Invalid access token"})
+                return False
+            self.send({"type": "auth_ok", "ha_version": "mock"})
+        elif kind == "subscribe_entities":
+            self.entity_subscription = message["id"]
+            self.entity_ids = message.get("entity_ids", [])
+            self.send({"id": message["id"], "type": "result", "success": True, "result": None})
+            snapshot = {e: model.ensure(e) for e in self.entity_ids}
+            self.send({"id": message["id"], "type": "event", "event": {"a": snapshot}})
+            self.server.notify("subscribed", self)
+        elif kind == "render_template":
+            self.template_subscription = message["id"]
+            match = re.search(r"for e in \[([^\]]*)\]", message.get("template", ""))
+            self.template_ids = re.findall(r"'([^']+)'", match.group(1)) if match else []
+            self.send({"id": message["id"], "type": "result", "success": True, "result": None})
+            self.send({"id": message["id"], "type": "event",
+                       "event": {"result": model.compact(self.template_ids), "listeners": {}}})
+            self.server.notify("subscribed", self)
+        elif kind == "call_service":
+            await self.server.record_call(message)
+            self.server.notify("call", self)
+            self.send({"id": message["id"], "type": "result", "success": True, "result": {"context": {}}})
+            changes = self.server.apply_service(message)
+            if changes:
+                self.server.broadcast(changes)
+        elif kind == "execute_script" and self.server.args.refuse_scripts:
+            self.send({"id": message["id"], "type": "result", "success": False,
+                       "error": {"code": "unauthorized", "message": "Unauthorized"}})
+        elif kind == "execute_script":
+            # Each step runs like its own service call; their changes go out as one event
+            changes = {}
+            for step in message.get("sequence", []):
+                domain, _, service = (step.get("service") or step.get("action", "")).partition(".")
+                call = {"id": message["id"], "domain": domain, "service": service,
+                        "target": step.get("target", {}), "service_data": step.get("data", {})}
+                await self.server.record_call(call)
+                self.server.notify("call", self)
+                changes.update(self.server.apply_service(call))
+            self.send({"id": message["id"], "type": "result", "success": True,
+                       "result": {"context": {}, "response": None}})
+            if changes:
+                self.server.broadcast(changes)
+        elif kind == "ping":
+            self.send({"id": message["id"], "type": "pong"})
+        else:
+            self.send({"id": message.get("id"), "type": "result", "success": False,
+                       "error": {"code": "unknown_command", "message": "Unknown command."}})
+        return True
+
+    async def run(self):
+        await self.handshake()
+        self.send({"type": "auth_required", "ha_version": "mock"})
+        stall_at = time.monotonic() + self.server.args.stall_after if self.server.args.stall_after else None
+        while True:
+            opcode, data = await self.read_frame()
+            if stall_at is not None and time.monotonic() >= stall_at:
+                # Keep the TCP connection open but never answer again, like a half-open link
+                print("stalling connection from %s" % (self.writer.get_extra_info("peername"),))
+                self.stalled = True
+                await asyncio.Event().wait()
+            if opcode == OP_CLOSE:
+                self.send_frame(OP_CLOSE, data[:2])
+                break
+            if opcode == OP_PING:
+                self.send_frame(OP_PONG, data)
+                continue
+            if opcode != OP_TEXT:
+                continue
+            if not await self.handle_message(json.loads(data)):
+                break
+            await self.writer.drain()
+
+
+class MockHomeAssistant:
+    def __init__(self, args):
+        self.args = args
+        self.stats = Stats()
+        self.model = EntityModel(args.attribute_padding)
+        self.connections = set()
+        self.calls_log = open(args.calls_log, "a", buffering=1) if args.calls_log else None
+        self.started = time.monotonic()
+        self.observers = []  # Called with (event, connection) when a client connects, subscribes or calls a service
+
+    def notify(self, event, connection):
+        for observer in self.observers:
+            observer(event, connection)
+
+    async def record_call(self, message):
+        self.stats.calls += 1
+        now = time.time()
+        target = message.get("target", {}).get("entity_id")
+        line = "%.6f,%s,%s.%s,%s,%s" % (now, message.get("id"), message.get("domain"), message.get("service"),
+                                         json.dumps(target), json.dumps(message.get("service_data", {})))
+        print("call " + line)
+        if self.calls_log:
+            self.calls_log.write(line + "\n")
+
+    def apply_service(self, message):
+        """Mirrors a service call into the model and returns the resulting changes."""
+        target = message.get("target", {}).get("entity_id")
+        entity_ids = target if isinstance(target, list) else [target] if target else []
+        service = message.get("service")
+        data = message.get("service_data", {})
+        changes = {}
+        for entity_id in entity_ids:
+            if service in ("toggle", "media_play_pause"):
+                changes[entity_id] = self.model.toggle(entity_id)
+            elif service == "turn_on":
+                changes[entity_id] = self.model.set(entity_id, "on", **data)
+            elif service == "turn_off":
+                changes[entity_id] = self.model.set(entity_id, "off")
+            elif service in ("media_play", "media_pause"):
+                changes[entity_id] = self.model.set(entity_id, "playing" if service == "media_play" else "paused")
+            elif service == "volume_set":
+                changes[entity_id] = self.model.set(entity_id, None, volume_level=data.get("volume_level", 0))
+        return changes
+
+    def broadcast(self, changes):
+        for connection in list(self.connections):
+            connection.push_changes(changes)
+
+    async def handle_client(self, reader, writer):
+        connection = Connection(self, reader, writer)
+        self.connections.add(connection)
+        self.stats.connections += 1
+        print("client connected from %s:%d" % writer.get_extra_info("peername")[:2])
+        tls = writer.get_extra_info("ssl_object")
+        if tls is not None:
+            print("  %s %s" % (tls.version(), tls.cipher()[0]))
+        self.notify("connected", connection)
+        try:
+            await connection.run()
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            self.connections.discard(connection)
+            writer.close()
+            print("client disconnected")
+
+    async def generate_deltas(self):
+        if self.args.rate <= 0:
+            return
+        interval = 1.0 / self.args.rate
+        while True:
+            await asyncio.sleep(interval)
+            for connection in list(self.connections):
+                entity_ids = connection.entity_ids or connection.template_ids
+                if not entity_ids:
+                    continue
+                if connection.congested():
+                    # The client is not keeping up; count what we would have sent
+                    self.stats.deltas_dropped += 1
+                    continue
+                chosen = random.sample(entity_ids, min(self.args.delta_size, len(entity_ids)))
+                connection.push_changes({e: self.model.mutate(e) for e in chosen})
+                self.stats.deltas_sent += 1
+
+    async def report(self):
+        while True:
+            await asyncio.sleep(self.args.report_interval)
+            print("[%7.1fs] %s" % (time.monotonic() - self.started, self.stats.line()))
+
+
+def tls_context(cert, key):
+    """The server context for --tls-cert and --tls-key, or None to serve plain ws://."""
+    if not cert:
+        return None
+    context = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+    context.load_cert_chain(cert, key)
+    return context
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8123)
+    parser.add_argument("--token", default="", help="Require this access token (default: accept any)")
+    parser.add_argument("--rate", type=float, default=0, help="State deltas per second pushed to each client")
+    parser.add_argument("--delta-size", type=int, default=1, help="Entities changed per delta")
+    parser.add_argument("--attribute-padding", type=int, default=0,
+                        help="Bytes of filler attribute per entity, to inflate snapshots")
+    parser.add_argument("--fragment-size", type=int, default=0,
+                        help="Split outgoing messages into frames of at most this many bytes (default: never)")
+    parser.add_argument("--max-backlog", type=int, default=64 * 1024,
+                        help="Unsent bytes per client before deltas are counted as dropped")
+    parser.add_argument("--report-interval", type=float, default=10, help="Seconds between stats lines")
+    parser.add_argument("--stall-after", type=float, default=0,
+                        help="Stop answering each connection this many seconds after it opens (default: never)")
+    parser.add_argument("--calls-log", help="Append every service call to this CSV file")
+    parser.add_argument("--refuse-scripts", action="store_true",
+                        help="Answer execute_script with an error, like Home Assistant does for a non-admin token")
+    parser.add_argument("--tls-cert", help="Serve wss:// with this PEM certificate (chain)")
+    parser.add_argument("--tls-key", help="Private key for --tls-cert")
+    args = parser.parse_args()
+
+    tls = tls_context(args.tls_cert, args.tls_key)
+    mock = MockHomeAssistant(args)
+    server = await asyncio.start_server(mock.handle_client, args.host, args.port, ssl=tls)
+    print("mock Home Assistant listening on %s://%s:%d" % ("wss" if tls else "ws", args.host, args.port))
+    async with server:
+        await asyncio.gather(server.serve_forever(), mock.generate_deltas(), mock.report())
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
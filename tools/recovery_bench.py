@@ -0,0 +1,270 @@
+#!/usr/bin/env python3
+"""Measures how a deck recovers from network faults.
+
+Runs tools/mock_ha.py and tools/chaos_proxy.py in one process. Point HA_HOST/HA_PORT
+in secrets.h at this machine and --port, then run, for example
+
+    python3 tools/recovery_bench.py --port 8123 --repeat 3 --metrics-url http://deck.local:9100/metrics
+
+Each run waits for the deck to be subscribed, applies a fault profile for
+--fault-seconds, clears it, and waits for the deck to recover. Meanwhile one of the
+deck's entities changes every --change-interval seconds. Per run it reports:
+
+    detect    fault start until the deck opened a new connection (- if it never did)
+    recover   fault cleared until data sent after that reaches a subscribed connection
+    stale     first entity change after the fault started until the deck received it,
+              i.e. how long the keys showed an outdated state
+    presses   key presses counted by the deck during the run (needs --metrics-url)
+    lost      presses that never reached Home Assistant as a service call
+
+Press plain toggle keys during the fault to measure lost presses; brightness
+adjustments and gesture actions count as presses but not always as one call each.
+
+--wifi-down-cmd and --wifi-up-cmd add a "wifi" profile that runs the commands (e.g.
+to switch the access point off and on over ssh) and refuses connections meanwhile,
+like a router reboot. It exercises the deck's WiFi reconnect as well.
+
+Only the Python standard library is used.
+"""
+
+import argparse
+import asyncio
+import csv
+import statistics
+import sys
+import time
+import urllib.request
+
+import chaos_proxy
+import mock_ha
+
+DEFAULT_PROFILES = ["latency", "jitter", "stall", "half_open", "reset", "outage"]
+
+
+def scrape(url):
+    """Returns the deck's metrics as {name: value}, ignoring labelled series."""
+    with urllib.request.urlopen(url, timeout=5) as response:
+        text = response.read().decode()
+    values = {}
+    for line in text.splitlines():
+        if line and not line.startswith("#") and "{" not in line:
+            name, value = line.split()
+            values[name] = float(value)
+    return values
+
+
+class Bench:
+    def __init__(self, args, proxy, mock):
+        self.args = args
+        self.proxy = proxy
+        self.mock = mock
+        self.subscribed_ports = set()  # Upstream ports of proxy links whose client has subscribed
+        self.entity_ids = []           # Entities the deck last subscribed to; they keep changing while it is away
+        self.waiters = []              # (received after, future) resolved by the first fresh delivery
+        self.change_waiter = None
+        self.opened = 0
+        self.open_times = []
+        self.calls = 0
+        proxy.observers.append(self.on_proxy)
+        mock.observers.append(self.on_mock)
+
+    def on_mock(self, event, connection):
+        if event == "subscribed":
+            self.subscribed_ports.add(connection.writer.get_extra_info("peername")[1])
+            self.entity_ids = sorted(connection.entity_ids or connection.template_ids)
+        elif event == "call":
+            self.calls += 1
+
+    def on_proxy(self, event, link, *details):
+        if event in ("opened", "refused"):
+            self.opened += 1
+            self.open_times.append(time.monotonic())
+        elif event == "delivered" and link.upstream_port in self.subscribed_ports:
+            now = time.monotonic()
+            for after, future in self.waiters:
+                if details[0] >= after and not future.done():
+                    future.set_result(now)
+            self.waiters = [w for w in self.waiters if not w[1].done()]
+
+    def fresh_delivery(self, after):
+        """Resolves with the time data the proxy received at or after `after` reaches the deck."""
+        future = asyncio.get_event_loop().create_future()
+        self.waiters.append((after, future))
+        return future
+
+    def next_change_delivery(self):
+        """Resolves with (change time, delivery time) of the next entity change."""
+        self.change_waiter = asyncio.get_event_loop().create_future()
+        return self.change_waiter
+
+    async def change_entities(self):
+        """Toggles one of the subscribed entities every --change-interval seconds."""
+        while True:
+            await asyncio.sleep(self.args.change_interval)
+            if not self.entity_ids:
+                continue
+            entity_id = self.entity_ids[int(time.monotonic() / self.args.change_interval) % len(self.entity_ids)]
+            changed_at = time.monotonic()
+            self.mock.broadcast({entity_id: self.mock.model.toggle(entity_id)})
+            if self.change_waiter is not None and not self.change_waiter.done():
+                waiter, self.change_waiter = self.change_waiter, None
+                delivered = self.fresh_delivery(changed_at)
+                delivered.add_done_callback(lambda f, w=waiter, c=changed_at: w.done() or w.set_result((c, f.result())))
+
+    async def wait_ready(self):
+        try:
+            await asyncio.wait_for(self.fresh_delivery(time.monotonic()), self.args.recover_timeout)
+        except asyncio.TimeoutError:
+            sys.exit("no subscribed deck on port %d after %.0f s" % (self.args.port, self.args.recover_timeout))
+
+    async def metrics(self):
+        if not self.args.metrics_url:
+            return None
+        try:
+            return await asyncio.get_event_loop().run_in_executor(None, scrape, self.args.metrics_url)
+        except (OSError, ValueError) as error:
+            print("could not read %s: %s" % (self.args.metrics_url, error))
+            return None
+
+    async def shell(self, command):
+        process = await asyncio.create_subprocess_shell(command)
+        await process.wait()
+
+    async def run(self, profile):
+        await self.wait_ready()
+        before = await self.metrics()
+        calls = self.calls
+        opened = self.opened
+
+        started = time.monotonic()
+        if profile == "wifi":
+            await self.shell(self.args.wifi_down_cmd)
+            self.proxy.apply(chaos_proxy.PROFILES["outage"])
+        else:
+            self.proxy.apply(chaos_proxy.PROFILES[profile])
+        stale = self.next_change_delivery()
+        await asyncio.sleep(self.args.fault_seconds)
+        if profile == "wifi":
+            await self.shell(self.args.wifi_up_cmd)
+        self.proxy.clear()
+        cleared = time.monotonic()
+
+        result = {"profile": profile, "detect": None, "recover": None, "stale": None,
+                  "reconnects": 0, "presses": None, "lost": None, "dropped": None}
+        try:
+            result["recover"] = await asyncio.wait_for(self.fresh_delivery(cleared),
+                                                       self.args.recover_timeout) - cleared
+            changed_at, delivered_at = await asyncio.wait_for(stale, self.args.recover_timeout)
+            result["stale"] = delivered_at - changed_at
+        except asyncio.TimeoutError:
+            pass
+        if self.opened > opened:
+            result["detect"] = self.open_times[opened] - started
+        result["reconnects"] = self.opened - opened
+
+        # Presses buffered offline go out right after the reconnect
+        await asyncio.sleep(self.args.settle_seconds)
+        after = await self.metrics()
+        if before and after:
+            presses = after["deck_key_presses_total"] - before["deck_key_presses_total"]
+            result["presses"] = int(presses)
+            result["lost"] = int(max(0, presses - (self.calls - calls)))
+            result["dropped"] = int(after["deck_outbound_dropped_total"] + after["deck_outbound_expired_total"] -
+                                    before["deck_outbound_dropped_total"] - before["deck_outbound_expired_total"])
+        return result
+
+
+def seconds(value):
+    return "-" if value is None else "%.2f" % value
+
+
+def print_summary(results):
+    print("\n%-10s %5s %9s %9s %9s %9s %9s %10s %7s" % ("profile", "runs", "detect", "recover", "recover",
+                                                      "stale", "stale", "reconnects", "lost"))
+    print("%-10s %5s %9s %9s %9s %9s %9s %10s %7s" % ("", "", "median", "median", "max", "median", "max", "", ""))
+    for profile in dict.fromkeys(r["profile"] for r in results):
+        runs = [r for r in results if r["profile"] == profile]
+
+        def column(key, combine):
+            values = [r[key] for r in runs if r[key] is not None]
+            return combine(values) if values else None
+
+        failed = sum(1 for r in runs if r["recover"] is None)
+        lost = column("lost", sum)
+        print("%-10s %5d %9s %9s %9s %9s %9s %10d %7s%s" % (
+            profile, len(runs), seconds(column("detect", statistics.median)),
+            seconds(column("recover", statistics.median)), seconds(column("recover", max)),
+            seconds(column("stale", statistics.median)), seconds(column("stale", max)),
+            sum(r["reconnects"] for r in runs), "-" if lost is None else lost,
+            "  (%d never recovered)" % failed if failed else ""))
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8123, help="Port the deck connects to")
+    parser.add_argument("--mock-port", type=int, default=18123, help="Local port for the mock Home Assistant")
+    parser.add_argument("--token", default="", help="Require this access token (default: accept any)")
+    parser.add_argument("--profiles", default=",".join(DEFAULT_PROFILES),
+                        help="Comma separated chaos_proxy profiles to run, plus wifi")
+    parser.add_argument("--repeat", type=int, default=3, help="Runs per profile")
+    parser.add_argument("--fault-seconds", type=float, default=20)
+    parser.add_argument("--recover-timeout", type=float, default=90,
+                        help="Seconds to wait for the deck before a run counts as never recovered")
+    parser.add_argument("--settle-seconds", type=float, default=3,
+                        help="Seconds after recovery for buffered presses to arrive")
+    parser.add_argument("--change-interval", type=float, default=0.5, help="Seconds between entity changes")
+    parser.add_argument("--metrics-url", help="The deck's /metrics endpoint (ENABLE_METRICS_ENDPOINT)")
+    parser.add_argument("--wifi-down-cmd", help="Shell command that takes the deck's WiFi down")
+    parser.add_argument("--wifi-up-cmd", help="Shell command that brings it back")
+    parser.add_argument("--csv", help="Write one row per run to this file")
+    args = parser.parse_args()
+
+    profiles = [p for p in args.profiles.split(",") if p]
+    for profile in profiles:
+        if profile == "wifi" and not (args.wifi_down_cmd and args.wifi_up_cmd):
+            parser.error("the wifi profile needs --wifi-down-cmd and --wifi-up-cmd")
+        if profile != "wifi" and profile not in chaos_proxy.PROFILES:
+            parser.error("unknown profile %s" % profile)
+
+    mock = mock_ha.MockHomeAssistant(argparse.Namespace(
+        token=args.token, rate=0, delta_size=1, attribute_padding=0, fragment_size=0, max_backlog=64 * 1024,
+        report_interval=10, stall_after=0, calls_log=None, refuse_scripts=False))
+    proxy = chaos_proxy.ChaosProxy("127.0.0.1", args.mock_port)
+    bench = Bench(args, proxy, mock)
+
+    mock_server = await asyncio.start_server(mock.handle_client, "127.0.0.1", args.mock_port)
+    proxy_server = await proxy.start(args.host, args.port)
+    changer = asyncio.ensure_future(bench.change_entities())
+    print("waiting for the deck on port %d" % args.port)
+
+    results = []
+    async with mock_server, proxy_server:
+        for profile in profiles:
+            for run in range(args.repeat):
+                result = await bench.run(profile)
+                results.append(result)
+                print("%-10s run %d: detect %s s, recover %s s, stale %s s, %d reconnects, presses %s, lost %s" % (
+                    profile, run + 1, seconds(result["detect"]), seconds(result["recover"]),
+                    seconds(result["stale"]), result["reconnects"],
+                    "-" if result["presses"] is None else result["presses"],
+                    "-" if result["lost"] is None else result["lost"]))
+        changer.cancel()
+        for link in list(proxy.links):
+            link.close()
+        await asyncio.sleep(0.1)  # Lets the mock see the connections close
+
+    print_summary(results)
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=["profile", "detect", "recover", "stale", "reconnects",
+                                                   "presses", "lost", "dropped"])
+            writer.writeheader()
+            writer.writerows(results)
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass